@@ -0,0 +1,712 @@
+#define _POSIX_C_SOURCE 200809L
+#include "nn.h"
+#include "dataset.h"
+#include "graph.h"
+#include "kernels.h"
+#include "optim.h"
+#include "program.h"
+#include "trainer.h"
+#include "value.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Micro-benchmarks, written as one JSON document to stdout so runs can be
+ * stored and diffed. Progress goes to stderr.
+ *
+ * Every case is a function that does `units` units of work (nodes, samples,
+ * bytes) per call. The number of calls per repeat is grown until a repeat
+ * takes at least min_time, then several repeats are timed and the median
+ * and the fastest are reported per unit.
+ */
+
+typedef void (*Bench_Fn)(void *ctx);
+
+typedef struct {
+    size_t width;           /* MLP input and hidden width */
+    size_t depth;           /* hidden layers */
+    size_t checkpoint;      /* layers per checkpointed segment */
+    size_t batch;
+    size_t threads;
+    size_t repeats;
+    double min_time;        /* seconds per repeat */
+    bool quick;
+    const char *model_file;
+    const char *mnist_images;
+    const char *mnist_labels;
+} Bench_Config;
+
+typedef struct {
+    Bench_Config cfg;
+    FILE *out;
+    size_t n_results;
+} Bench;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Start a new element of the results array */
+static void bench_entry(Bench *b) {
+    fprintf(b->out, "%s\n    ", b->n_results ? "," : "");
+    b->n_results++;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double time_calls(Bench_Fn fn, void *ctx, size_t calls) {
+    double t0 = now_seconds();
+    for (size_t i = 0; i < calls; ++i) fn(ctx);
+    return now_seconds() - t0;
+}
+
+/*
+ * Time fn and append one result. unit names what a call does `units` of;
+ * the rate is reported as units per second.
+ */
+static void bench_run(Bench *b, const char *name, const char *unit, size_t units, Bench_Fn fn, void *ctx) {
+    fprintf(stderr, "bench: %s\n", name);
+
+    // Warm up caches and the arenas, then calibrate
+    fn(ctx);
+    size_t calls = 1;
+    while (calls < ((size_t)1 << 30)) {
+        double t = time_calls(fn, ctx, calls);
+        if (t >= b->cfg.min_time) break;
+        calls = t > 0 && b->cfg.min_time / t < 16 ? (size_t)(calls * (b->cfg.min_time / t) * 1.2) + 1 : calls * 16;
+    }
+
+    double samples[64];
+    size_t repeats = b->cfg.repeats < 64 ? b->cfg.repeats : 64;
+    for (size_t r = 0; r < repeats; ++r) {
+        samples[r] = time_calls(fn, ctx, calls) * 1e9 / ((double)calls * (double)units);
+    }
+    qsort(samples, repeats, sizeof(double), cmp_double);
+
+    double median = repeats % 2 ? samples[repeats / 2] : 0.5 * (samples[repeats / 2 - 1] + samples[repeats / 2]);
+
+    bench_entry(b);
+    fprintf(b->out, "{\"name\": \"%s\", \"unit\": \"%s\", \"units_per_call\": %zu, \"calls\": %zu, "
+            "\"repeats\": %zu, \"ns_per_unit\": %.4f, \"ns_per_unit_min\": %.4f, \"per_second\": %.6g}",
+            name, unit, units, calls, repeats, median, samples[0], median > 0 ? 1e9 / median : 0.0);
+}
+
+static mg_real rand_real(mg_real lo, mg_real hi) {
+    return lo + (hi - lo) * (mg_real)rand() / (mg_real)RAND_MAX;
+}
+
+/* Single ops: build n independent nodes from leaves, then run their backward */
+
+typedef enum {
+    BENCH_ADD, BENCH_SUB, BENCH_MUL, BENCH_DIV, BENCH_POW,
+    BENCH_NEG, BENCH_EXP, BENCH_LOG, BENCH_TANH, BENCH_RELU, BENCH_SIGMOID,
+    BENCH_DOT_BIAS,
+    BENCH_OP_COUNT
+} Bench_Op;
+
+static const char *bench_op_names[BENCH_OP_COUNT] = {
+    "add", "sub", "mul", "div", "pow", "neg", "exp", "log", "tanh", "relu", "sigmoid", "dot_bias"
+};
+
+#define BENCH_DOT_N 16
+
+typedef struct {
+    Bench_Op op;
+    Arena *a;
+    size_t n;
+    Value **x, **y;     /* leaves, x in (0.5, 2) so log/pow/div stay finite */
+    Value **out;
+} Op_Ctx;
+
+static Value *op_build(Op_Ctx *c, size_t i) {
+    Arena *a = c->a;
+    Value *x = c->x[i], *y = c->y[i];
+
+    switch (c->op) {
+        case BENCH_ADD:     return value_add(a, x, y);
+        case BENCH_SUB:     return value_sub(a, x, y);
+        case BENCH_MUL:     return value_mul(a, x, y);
+        case BENCH_DIV:     return value_div(a, x, y);
+        case BENCH_POW:     return value_pow(a, x, y);
+        case BENCH_NEG:     return value_neg(a, x);
+        case BENCH_EXP:     return value_exp(a, x);
+        case BENCH_LOG:     return value_log(a, x);
+        case BENCH_TANH:    return value_tanh(a, x);
+        case BENCH_RELU:    return value_relu(a, x);
+        case BENCH_SIGMOID: return value_sigmoid(a, x);
+        case BENCH_DOT_BIAS: {
+            size_t j = i % (c->n - BENCH_DOT_N);
+            return value_dot_bias(a, &c->x[j], &c->y[j], BENCH_DOT_N, y);
+        }
+        default: return NULL;
+    }
+}
+
+static void op_forward(void *ctx) {
+    Op_Ctx *c = ctx;
+    arena_reset(c->a);
+    for (size_t i = 0; i < c->n; ++i) c->out[i] = op_build(c, i);
+}
+
+static void op_backward(void *ctx) {
+    Op_Ctx *c = ctx;
+    for (size_t i = 0; i < c->n; ++i) {
+        Value *v = c->out[i];
+        v->grad = 1;
+        v->backward(v);
+    }
+}
+
+static void bench_ops(Bench *b) {
+    Arena leaf_arena = {0};
+    Arena graph_arena = {0};
+    size_t n = b->cfg.quick ? 1024 : 4096;
+
+    Op_Ctx c = { .a = &graph_arena, .n = n };
+    c.x = arena_alloc(&leaf_arena, sizeof(Value*) * n);
+    c.y = arena_alloc(&leaf_arena, sizeof(Value*) * n);
+    c.out = arena_alloc(&leaf_arena, sizeof(Value*) * n);
+    for (size_t i = 0; i < n; ++i) {
+        c.x[i] = value_alloc(&leaf_arena, rand_real(0.5, 2));
+        c.y[i] = value_alloc(&leaf_arena, rand_real(0.5, 2));
+    }
+
+    char name[64];
+    for (int op = 0; op < BENCH_OP_COUNT; ++op) {
+        c.op = (Bench_Op)op;
+        snprintf(name, sizeof(name), "op/%s/forward", bench_op_names[op]);
+        bench_run(b, name, "node", n, op_forward, &c);
+
+        // Backward of the graph the last forward call left behind
+        snprintf(name, sizeof(name), "op/%s/backward", bench_op_names[op]);
+        bench_run(b, name, "node", n, op_backward, &c);
+    }
+
+    arena_free(&graph_arena);
+    arena_free(&leaf_arena);
+}
+
+/* MLP forward and backward, through the graph and batched */
+
+typedef struct {
+    Arena *a;
+    MLP *m;
+    Value **x;
+    Value *target;
+    size_t n_in, n_out, batch;
+    size_t every;       /* mlp_forward_checkpoint segment, 0 for mlp_forward */
+    mg_real *xs;        /* batch x n_in inputs */
+    size_t *labels;
+    mg_real *dlogits;
+    mg_real *probs;
+    size_t *classes;
+    Program *program;   /* the graph of mlp_ctx_loss, compiled */
+    Value **targets;    /* n_out regression targets for the MSE cases */
+    Arena *soa_arena;
+    size_t soa_nodes;   /* Graph capacity of mlp_soa_loss */
+} Mlp_Ctx;
+
+#define BENCH_CLASSES 10
+
+static Value *mlp_ctx_loss(Mlp_Ctx *c) {
+    arena_reset(c->a);
+    Value **out = mlp_forward_checkpoint(c->a, c->m, c->x, c->n_in, c->every);
+    return softmax_cross_entropy(c->a, out, c->target, c->n_out);
+}
+
+static void mlp_graph_forward(void *ctx) {
+    mlp_ctx_loss(ctx);
+}
+
+static void mlp_graph_step(void *ctx) {
+    Mlp_Ctx *c = ctx;
+    value_backward(c->a, mlp_ctx_loss(c));
+}
+
+static void mlp_program_forward(void *ctx) {
+    program_forward(((Mlp_Ctx*)ctx)->program);
+}
+
+static void mlp_program_step(void *ctx) {
+    program_run(((Mlp_Ctx*)ctx)->program);
+}
+
+static void mlp_batch_forward(void *ctx) {
+    Mlp_Ctx *c = ctx;
+    arena_reset(c->a);
+    mlp_forward_batch(c->a, c->m, c->xs, c->batch);
+}
+
+static void mlp_batch_step(void *ctx) {
+    Mlp_Ctx *c = ctx;
+    arena_reset(c->a);
+    Batch *bt = mlp_forward_batch(c->a, c->m, c->xs, c->batch);
+    softmax_cross_entropy_batch(bt->y[c->m->layer_size - 1], c->labels, c->batch, c->n_out, c->dlogits);
+    mlp_backward_batch(c->a, c->m, bt, c->dlogits);
+}
+
+static void mlp_predict_step(void *ctx) {
+    Mlp_Ctx *c = ctx;
+    mlp_predict_batch(c->m, c->xs, c->batch, c->probs, c->classes);
+}
+
+/* MLP + MSE as Values and on the struct-of-arrays Graph, one node per scalar op */
+
+static Value *mlp_mse_loss(Mlp_Ctx *c) {
+    arena_reset(c->a);
+    Value **out = mlp_forward(c->a, c->m, c->x, c->n_in);
+    return mse(c->a, out, c->targets, c->n_out);
+}
+
+static void mlp_mse_step(void *ctx) {
+    Mlp_Ctx *c = ctx;
+    value_backward(c->a, mlp_mse_loss(c));
+}
+
+static Graph *mlp_soa_loss(Mlp_Ctx *c, Node_Id *params, Node_Id *loss) {
+    arena_reset(c->soa_arena);
+    Graph *g = graph_alloc(c->soa_arena, c->soa_nodes);
+    Node_Id *x = arena_alloc(c->soa_arena, sizeof(Node_Id) * c->n_in);
+    Node_Id *t = arena_alloc(c->soa_arena, sizeof(Node_Id) * c->n_out);
+
+    *params = graph_mlp_params(g, c->m);
+    for (size_t i = 0; i < c->n_in; ++i) x[i] = graph_leaf(g, c->x[i]->data);
+    for (size_t i = 0; i < c->n_out; ++i) t[i] = graph_leaf(g, c->targets[i]->data);
+    *loss = graph_mse(g, graph_mlp_forward(g, c->m, *params, x), t, c->n_out);
+    return g;
+}
+
+static void mlp_soa_forward(void *ctx) {
+    Node_Id params, loss;
+    mlp_soa_loss(ctx, &params, &loss);
+}
+
+static void mlp_soa_step(void *ctx) {
+    Mlp_Ctx *c = ctx;
+    Node_Id params, loss;
+    Graph *g = mlp_soa_loss(c, &params, &loss);
+    graph_backward(g, loss);
+    graph_mlp_grads(g, c->m, params);
+}
+
+/* The Graph has to agree with value_backward before it is worth timing */
+static void mlp_soa_check(Mlp_Ctx *c) {
+    size_t n = c->m->n_params;
+    mg_real *want = malloc(sizeof(mg_real) * n);
+    if (!want) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+
+    mlp_zero_grad(c->m);
+    Value *loss = mlp_mse_loss(c);
+    value_backward(c->a, loss);
+    memcpy(want, c->m->grads, sizeof(mg_real) * n);
+
+    mlp_zero_grad(c->m);
+    Node_Id params, root;
+    Graph *g = mlp_soa_loss(c, &params, &root);
+    graph_backward(g, root);
+    graph_mlp_grads(g, c->m, params);
+    c->soa_nodes = g->count;
+
+    double tol = MG_REAL_IS_FLOAT ? 1e-3 : 1e-9;
+    double err = (double)(g->data[root] - loss->data);
+    if (err < 0) err = -err;
+    for (size_t i = 0; i < n; ++i) {
+        double d = (double)(c->m->grads[i] - want[i]);
+        double w = (double)want[i];
+        if (d < 0) d = -d;
+        if (w < 0) w = -w;
+        if (d / (1 + w) > err) err = d / (1 + w);
+    }
+    if (err > tol) {
+        fprintf(stderr, "bench: Graph loss or gradients differ from value_backward by %g\n", err);
+        exit(1);
+    }
+
+    mlp_zero_grad(c->m);
+    free(want);
+}
+
+static MLP *bench_mlp(Arena *a, size_t n_in, size_t width, size_t depth, size_t n_out) {
+    Layer_Config *cfgs = arena_alloc(a, sizeof(Layer_Config) * (depth + 1));
+    size_t in = n_in;
+    for (size_t i = 0; i < depth; ++i) {
+        cfgs[i] = NN_LAYER_CFG(in, width, ACT_RELU);
+        in = width;
+    }
+    cfgs[depth] = NN_LAYER_CFG(in, n_out, ACT_LINEAR);
+    return mlp_alloc(a, cfgs, depth + 1);
+}
+
+static void bench_mlp_throughput(Bench *b) {
+    Arena param_arena = {0};
+    Arena graph_arena = {0};
+    size_t width = b->cfg.width, depth = b->cfg.depth, batch = b->cfg.batch;
+
+    Mlp_Ctx c = { .a = &graph_arena, .n_in = width, .n_out = BENCH_CLASSES, .batch = batch };
+    c.m = bench_mlp(&param_arena, width, width, depth, BENCH_CLASSES);
+    c.x = value_alloc_input(&param_arena, width);
+    c.target = value_alloc(&param_arena, 3);
+    c.xs = arena_alloc(&param_arena, sizeof(mg_real) * batch * width);
+    c.labels = arena_alloc(&param_arena, sizeof(size_t) * batch);
+    c.dlogits = arena_alloc(&param_arena, sizeof(mg_real) * batch * BENCH_CLASSES);
+    c.probs = arena_alloc(&param_arena, sizeof(mg_real) * batch * BENCH_CLASSES);
+    c.classes = arena_alloc(&param_arena, sizeof(size_t) * batch);
+    c.targets = value_alloc_input(&param_arena, BENCH_CLASSES);
+
+    for (size_t i = 0; i < batch * width; ++i) c.xs[i] = rand_real(0, 1);
+    for (size_t i = 0; i < batch; ++i) c.labels[i] = (size_t)rand() % BENCH_CLASSES;
+    value_set_input(c.x, c.xs, width);
+    mg_real targets[BENCH_CLASSES];
+    for (size_t i = 0; i < BENCH_CLASSES; ++i) targets[i] = rand_real(0, 1);
+    value_set_input(c.targets, targets, BENCH_CLASSES);
+
+    Graph_Plan plan = mlp_plan(c.m, LOSS_SOFTMAX_CE, 0);
+    Graph_Plan checkpoint_plan = mlp_plan_checkpoint(c.m, LOSS_SOFTMAX_CE, 0, b->cfg.checkpoint);
+    arena_reserve(&graph_arena, plan.total_bytes);
+
+    bench_entry(b);
+    fprintf(b->out, "{\"name\": \"mlp/shape\", \"width\": %zu, \"depth\": %zu, \"batch\": %zu, \"params\": %zu, "
+            "\"graph_bytes\": %zu, \"checkpoint\": %zu, \"checkpoint_graph_bytes\": %zu}",
+            width, depth, batch, c.m->n_params, plan.total_bytes, b->cfg.checkpoint, checkpoint_plan.total_bytes);
+
+    bench_run(b, "mlp/graph/forward", "sample", 1, mlp_graph_forward, &c);
+    bench_run(b, "mlp/graph/forward_backward", "sample", 1, mlp_graph_step, &c);
+
+    Arena program_arena = {0};
+    c.program = program_compile(&program_arena, mlp_ctx_loss(&c), c.x, width, NULL, 0);
+    bench_run(b, "mlp/program/forward", "sample", 1, mlp_program_forward, &c);
+    bench_run(b, "mlp/program/forward_backward", "sample", 1, mlp_program_step, &c);
+    if (program_jit(c.program) == 0) {
+        bench_run(b, "mlp/program_jit/forward", "sample", 1, mlp_program_forward, &c);
+        bench_run(b, "mlp/program_jit/forward_backward", "sample", 1, mlp_program_step, &c);
+        program_jit_free(c.program);
+    }
+    arena_free(&program_arena);
+
+    c.every = b->cfg.checkpoint;
+    bench_run(b, "mlp/graph_checkpoint/forward", "sample", 1, mlp_graph_forward, &c);
+    bench_run(b, "mlp/graph_checkpoint/forward_backward", "sample", 1, mlp_graph_step, &c);
+    bench_run(b, "mlp/batch/forward", "sample", batch, mlp_batch_forward, &c);
+    bench_run(b, "mlp/batch/forward_backward", "sample", batch, mlp_batch_step, &c);
+    bench_run(b, "mlp/predict_batch", "sample", batch, mlp_predict_step, &c);
+
+    Arena soa_arena = {0};
+    c.soa_arena = &soa_arena;
+    mlp_soa_check(&c);
+    bench_run(b, "mlp/graph_mse/forward_backward", "sample", 1, mlp_mse_step, &c);
+    bench_run(b, "mlp/soa_mse/forward", "sample", 1, mlp_soa_forward, &c);
+    bench_run(b, "mlp/soa_mse/forward_backward", "sample", 1, mlp_soa_step, &c);
+    arena_free(&soa_arena);
+
+    arena_free(&graph_arena);
+    arena_free(&param_arena);
+}
+
+/* value_backward over graphs of growing size */
+
+typedef struct {
+    Arena *a;
+    Value *root;
+} Backward_Ctx;
+
+static void backward_step(void *ctx) {
+    Backward_Ctx *c = ctx;
+    value_backward(c->a, c->root);
+}
+
+static void bench_backward_scaling(Bench *b) {
+    size_t sizes[] = { (size_t)1 << 10, (size_t)1 << 13, (size_t)1 << 16, (size_t)1 << 19 };
+    size_t n_sizes = b->cfg.quick ? 3 : sizeof(sizes) / sizeof(sizes[0]);
+    char name[64];
+
+    for (size_t s = 0; s < n_sizes; ++s) {
+        Arena graph_arena = {0};
+
+        // sum(tanh(x_i) * x_i): a long chain with short side branches
+        Value *root = value_alloc(&graph_arena, 0);
+        for (size_t i = 0; i < sizes[s]; ++i) {
+            Value *x = value_alloc(&graph_arena, rand_real(-1, 1));
+            root = value_add(&graph_arena, root, value_mul(&graph_arena, value_tanh(&graph_arena, x), x));
+        }
+
+        size_t n_nodes;
+        Arena_Mark mark = arena_snapshot(&graph_arena);
+        value_topo_sort(&graph_arena, root, &n_nodes);
+        arena_rewind(&graph_arena, mark);
+
+        Backward_Ctx c = { .a = &graph_arena, .root = root };
+        snprintf(name, sizeof(name), "value_backward/%zu", n_nodes);
+        bench_run(b, name, "node", n_nodes, backward_step, &c);
+
+        arena_free(&graph_arena);
+    }
+}
+
+/* Model save and load bandwidth */
+
+typedef struct {
+    Arena *a;
+    MLP *m;
+    const char *path;
+} Io_Ctx;
+
+static void io_save(void *ctx) {
+    Io_Ctx *c = ctx;
+    if (mlp_save(c->m, c->path) != 0) {
+        fprintf(stderr, "bench: failed to save %s\n", c->path);
+        exit(1);
+    }
+}
+
+static void io_load(void *ctx) {
+    Io_Ctx *c = ctx;
+    Arena_Mark mark = arena_snapshot(c->a);
+    if (!mlp_load(c->a, c->path)) {
+        fprintf(stderr, "bench: failed to load %s\n", c->path);
+        exit(1);
+    }
+    arena_rewind(c->a, mark);
+}
+
+static void io_load_mmap(void *ctx) {
+    Io_Ctx *c = ctx;
+    Arena_Mark mark = arena_snapshot(c->a);
+    MLP *m = mlp_load_mmap(c->a, c->path);
+    if (!m) {
+        fprintf(stderr, "bench: failed to map %s\n", c->path);
+        exit(1);
+    }
+
+    // Touch every page, a mapping alone reads nothing
+    volatile mg_real sum = 0;
+    for (size_t i = 0; i < m->n_params; i += 4096 / sizeof(mg_real)) sum += m->params[i];
+    (void)sum;
+
+    mlp_unmap(m);
+    arena_rewind(c->a, mark);
+}
+
+static void bench_io(Bench *b) {
+    Arena param_arena = {0};
+    Arena load_arena = {0};
+    size_t width = b->cfg.quick ? 256 : 1024;
+
+    Io_Ctx c = { .a = &load_arena, .path = b->cfg.model_file };
+    c.m = bench_mlp(&param_arena, width, width, 2, BENCH_CLASSES);
+    size_t bytes = c.m->n_params * sizeof(mg_real);
+
+    bench_run(b, "io/save", "byte", bytes, io_save, &c);
+    bench_run(b, "io/load", "byte", bytes, io_load, &c);
+    bench_run(b, "io/load_mmap", "byte", bytes, io_load_mmap, &c);
+
+    remove(c.path);
+    arena_free(&load_arena);
+    arena_free(&param_arena);
+}
+
+/* End-to-end MNIST training: trainer + Adam, as in examples/mnist.c */
+
+#define MNIST_FEATURES 784
+
+typedef struct {
+    Trainer *trainer;
+    Optimizer *opt;
+    MLP *m;
+    Batch_Iter *batches;        /* NULL when training on synthetic data */
+    const Data_Batch *batch;
+    size_t *positions;
+    size_t n_in;
+} Mnist_Ctx;
+
+static Value *mnist_loss(Arena *a, MLP *m, Value **x, size_t i, void *user) {
+    Mnist_Ctx *c = user;
+    mg_real label = (mg_real)c->batch->y[i];
+    value_set_input(x, &c->batch->x[i * c->n_in], c->n_in);
+    value_set_input(&x[c->n_in], &label, 1);
+    Value **out = mlp_forward(a, m, x, c->n_in);
+    return softmax_cross_entropy(a, out, x[c->n_in], BENCH_CLASSES);
+}
+
+static void mnist_step(void *ctx) {
+    Mnist_Ctx *c = ctx;
+    if (c->batches) c->batch = batch_iter_next(c->batches);
+    trainer_step(c->trainer, c->positions, c->batch->size, mnist_loss, c);
+    optim_step(c->opt);
+    mlp_zero_grad(c->m);
+}
+
+static bool file_exists(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f) fclose(f);
+    return f != NULL;
+}
+
+static void bench_mnist(Bench *b) {
+    Arena arena = {0};
+    size_t batch = b->cfg.batch;
+    Mnist_Ctx c = { .n_in = MNIST_FEATURES };
+
+    Dataset *d = NULL;
+    if (file_exists(b->cfg.mnist_images) && file_exists(b->cfg.mnist_labels)) {
+        d = dataset_open_idx(&arena, b->cfg.mnist_images, b->cfg.mnist_labels);
+    }
+
+    // Without the dataset, train on one fixed random batch of the same shape
+    Data_Batch synthetic = { .size = batch };
+    if (d && d->n_features == MNIST_FEATURES) {
+        c.batches = batch_iter_create(d, batch, 1);
+    } else {
+        mg_real *x = arena_alloc(&arena, sizeof(mg_real) * batch * MNIST_FEATURES);
+        size_t *y = arena_alloc(&arena, sizeof(size_t) * batch);
+        for (size_t i = 0; i < batch * MNIST_FEATURES; ++i) x[i] = rand_real(0, 1);
+        for (size_t i = 0; i < batch; ++i) y[i] = (size_t)rand() % BENCH_CLASSES;
+        synthetic.x = x;
+        synthetic.y = y;
+        c.batch = &synthetic;
+    }
+
+    c.m = bench_mlp(&arena, MNIST_FEATURES, 32, 1, BENCH_CLASSES);
+    c.opt = optim_alloc(&arena, c.m, OPTIM_ADAM_CFG(0.01));
+    c.trainer = trainer_create(c.m, b->cfg.threads, batch);
+    trainer_reserve(c.trainer, mlp_plan(c.m, LOSS_SOFTMAX_CE, 0).total_bytes);
+
+    c.positions = arena_alloc(&arena, sizeof(size_t) * batch);
+    for (size_t i = 0; i < batch; ++i) c.positions[i] = i;
+
+    bench_entry(b);
+    fprintf(b->out, "{\"name\": \"mnist/setup\", \"data\": \"%s\", \"hidden\": 32, \"threads\": %zu, \"batch\": %zu}",
+            c.batches ? "idx" : "synthetic", b->cfg.threads, batch);
+
+    // A batch at the end of an epoch can be short, count whole batches only
+    bench_run(b, "mnist/train", "sample", batch, mnist_step, &c);
+
+    trainer_destroy(c.trainer);
+    if (c.batches) batch_iter_destroy(c.batches);
+    if (d) dataset_close(d);
+    arena_free(&arena);
+}
+
+/* Driver */
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options] > bench.json\n"
+            "  --width N        MLP input and hidden width (default 128)\n"
+            "  --depth N        MLP hidden layers (default 2)\n"
+            "  --checkpoint K   layers per checkpointed segment (default 2)\n"
+            "  --batch N        batch size (default 32)\n"
+            "  --threads N      trainer threads for the MNIST case (default 4)\n"
+            "  --repeats N      timed repeats per case (default 5)\n"
+            "  --min-time MS    minimum time per repeat (default 50)\n"
+            "  --only LIST      comma separated groups: ops,mlp,backward,io,mnist\n"
+            "  --quick          smaller sizes and a shorter minimum time\n",
+            prog);
+}
+
+static size_t parse_size(const char *s, const char *opt) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v == 0) {
+        fprintf(stderr, "bench: %s expects a positive integer, got '%s'\n", opt, s);
+        exit(1);
+    }
+    return (size_t)v;
+}
+
+static bool group_enabled(const char *only, const char *group) {
+    if (!only) return true;
+
+    size_t n = strlen(group);
+    for (const char *p = only; *p;) {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == n && strncmp(p, group, n) == 0) return true;
+        if (!end) break;
+        p = end + 1;
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    Bench b = {
+        .cfg = {
+            .width = 128,
+            .depth = 2,
+            .checkpoint = 2,
+            .batch = 32,
+            .threads = 4,
+            .repeats = 5,
+            .min_time = 0.05,
+            .model_file = "bench_model.bin",
+            .mnist_images = "mnist/train-images.idx3-ubyte",
+            .mnist_labels = "mnist/train-labels.idx1-ubyte",
+        },
+        .out = stdout,
+    };
+    const char *only = NULL;
+    bool min_time_set = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--quick") == 0) {
+            b.cfg.quick = true;
+            continue;
+        }
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (!val) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        if (strcmp(arg, "--width") == 0) b.cfg.width = parse_size(val, arg);
+        else if (strcmp(arg, "--depth") == 0) b.cfg.depth = parse_size(val, arg);
+        else if (strcmp(arg, "--checkpoint") == 0) b.cfg.checkpoint = parse_size(val, arg);
+        else if (strcmp(arg, "--batch") == 0) b.cfg.batch = parse_size(val, arg);
+        else if (strcmp(arg, "--threads") == 0) b.cfg.threads = parse_size(val, arg);
+        else if (strcmp(arg, "--repeats") == 0) b.cfg.repeats = parse_size(val, arg);
+        else if (strcmp(arg, "--min-time") == 0) {
+            b.cfg.min_time = (double)parse_size(val, arg) * 1e-3;
+            min_time_set = true;
+        }
+        else if (strcmp(arg, "--only") == 0) only = val;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+        ++i;
+    }
+    if (b.cfg.quick && !min_time_set) b.cfg.min_time = 0.01;
+
+    srand(1);
+
+    fprintf(b.out, "{\n  \"schema\": 1,\n  \"precision\": \"%s\",\n  \"kernels\": \"%s\",\n"
+            "  \"compiler\": \"%s\",\n  \"quick\": %s,\n  \"results\": [",
+            MG_REAL_IS_FLOAT ? "float" : "double", kernels()->name, __VERSION__,
+            b.cfg.quick ? "true" : "false");
+
+    if (group_enabled(only, "ops")) bench_ops(&b);
+    if (group_enabled(only, "mlp")) bench_mlp_throughput(&b);
+    if (group_enabled(only, "backward")) bench_backward_scaling(&b);
+    if (group_enabled(only, "io")) bench_io(&b);
+    if (group_enabled(only, "mnist")) bench_mnist(&b);
+
+    fprintf(b.out, "\n  ]\n}\n");
+    return 0;
+}
@@ -1,61 +1,15 @@
 #include "nn.h"
+#include "dataset.h"
+#include "optim.h"
+#include "profile.h"
+#include "trace.h"
+#include "trainer.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>    
 
-#define READ_OR_FAIL(ptr, type, count, file, onfail) \
-    do { \
-        if (fread((ptr), sizeof(type), (size_t)(count), (file)) != (size_t)(count)) { \
-            fprintf(stderr, "Read failed at %s:%d\n", __FILE__, __LINE__); \
-            onfail; \
-        } \
-    } while (0)
-
-uint32_t read_be_uint32(FILE *f) {
-    uint8_t b[4];
-    READ_OR_FAIL(b, uint8_t, 4, f, { return 0; });
-    return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
-}
-
-unsigned char **load_mnist_images(Arena *arena, const char *filename, int *num_images, int *rows, int *cols) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) { perror(filename); return NULL; }
-
-    uint32_t magic = read_be_uint32(f);
-    if (magic != 2051) { fprintf(stderr, "Invalid MNIST image file: %s\n", filename); fclose(f); return NULL; }
-
-    *num_images = read_be_uint32(f);
-    *rows = read_be_uint32(f);
-    *cols = read_be_uint32(f);
-
-    unsigned char **images = arena_alloc(arena, *num_images * sizeof(unsigned char*));
-    for (int i = 0; i < *num_images; i++) {
-        images[i] = arena_alloc(arena, (*rows) * (*cols));
-        READ_OR_FAIL(images[i], unsigned char, (*rows) * (*cols), f, { fclose(f); return NULL; });
-    }
-
-    fclose(f);
-    return images;
-}
-
-unsigned char *load_mnist_labels(Arena *arena, const char *filename, int *num_labels) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) { perror(filename); return NULL; }
-
-    uint32_t magic = read_be_uint32(f);
-    if (magic != 2049) { fprintf(stderr, "Invalid MNIST label file: %s\n", filename); fclose(f); return NULL; }
-
-    *num_labels = read_be_uint32(f);
-
-    unsigned char *labels = arena_alloc(arena, *num_labels);
-    READ_OR_FAIL(labels, unsigned char, *num_labels, f, { fclose(f); return NULL; });
-
-    fclose(f);
-    return labels;
-}
-
 void render_image(unsigned char *img, int rows, int cols) {
     for (int r = 0; r < rows; r++) {
         for (int c = 0; c < cols; c++) {
@@ -68,41 +22,35 @@ void render_image(unsigned char *img, int rows, int cols) {
     }
 }
 
-Value **image_to_value(Arena *a, unsigned char *image, int size) {
-    Value **out = arena_alloc(a, sizeof(Value*) * size);
-    
-    for (int i = 0; i < size; ++i) {
-        out[i] = value_alloc(a, (double)image[i] / 255.0);
-    }
+typedef struct {
+    const Data_Batch *batch;
+    size_t size;
+} Mnist;
 
-    return out;
-}
+/* Loss of the i-th sample of the staged batch, built by a trainer worker */
+Value *mnist_loss(Arena *a, MLP *m, Value **x, size_t i, void *user) {
+    Mnist *data = user;
 
-Value *label_to_value(Arena *a, unsigned char label) {
-    return value_alloc(a, (double)label);
+    // Refill the worker's input and target placeholders in place
+    mg_real label = (mg_real)data->batch->y[i];
+    value_set_input(x, &data->batch->x[i * data->size], data->size);
+    value_set_input(&x[data->size], &label, 1);
+
+    Value **out = mlp_forward(a, m, x, data->size);
+    return softmax_cross_entropy(a, out, x[data->size], 10);
 }
 
 int main() {
     Arena mnist_arena = {0};
     Arena param_arena = {0};
-    Arena graph_arena = {0};
 
     const char *image_file = "mnist/train-images.idx3-ubyte";
     const char *label_file = "mnist/train-labels.idx1-ubyte";
 
-    int num_images, rows, cols;
-    
-    unsigned char **images = load_mnist_images(&mnist_arena, image_file, &num_images, &rows, &cols);
-
-    int size = rows * cols;
-    if (!images) return 1;
+    Dataset *train = dataset_open_idx(&mnist_arena, image_file, label_file);
+    if (!train) return 1;
 
-    int num_labels;
-    unsigned char *labels = load_mnist_labels(&mnist_arena, label_file, &num_labels);
-    if (!labels) return 1;
-
-    printf("Loaded %d images of size %dx%d\n", num_images, rows, cols);
-    printf("Loaded %d labels\n", num_labels);
+    printf("Loaded %zu images of size %zux%zu\n", train->count, train->rows, train->cols);
 
     Layer_Config cfgs[2] = {
         NN_LAYER_CFG(784, 8, ACT_RELU),
@@ -112,47 +60,71 @@ int main() {
     MLP *mlp = mlp_alloc(&param_arena, cfgs, 2);
 
     int epochs = 50;
-    double lr = 0.04;
     int sample_size = 100;  // number of images per epoch
+    int batch_size = 10;
+    int n_threads = 4;
+    Optimizer *opt = optim_alloc(&param_arena, mlp, OPTIM_ADAM_CFG(0.01));
 
     srand((unsigned int)time(NULL)); // seed RNG
 
-    for (int epoch = 0; epoch < epochs; ++epoch) {
-        printf("Epoch: %d\n", epoch);
-        double total_loss = 0;
+    // Batches are staged in the background while the trainer runs
+    Batch_Iter *batches = batch_iter_create(train, (size_t)batch_size, (uint64_t)rand());
+    if (!batches) return 1;
+
+    Mnist data = { .size = train->n_features };
+    Trainer *trainer = trainer_create(mlp, (size_t)n_threads, (size_t)batch_size);
+
+    // Every sample builds the same graph, size the worker arenas for it once
+    Graph_Plan plan = mlp_plan(mlp, LOSS_SOFTMAX_CE, 0);
+    printf("Graph per sample: %zu nodes, %zu bytes\n", plan.n_nodes, plan.total_bytes);
+    trainer_reserve(trainer, plan.total_bytes);
 
-        for (int i = 0; i < sample_size; ++i) {
-            int idx = rand() % num_images;  // random image index
+    // Samples are addressed by their position in the staged batch
+    size_t *batch = arena_alloc(&mnist_arena, sizeof(size_t) * batch_size);
+    for (int k = 0; k < batch_size; ++k) batch[k] = (size_t)k;
 
-            Value **image = image_to_value(&graph_arena, images[idx], size);
-            Value *target = label_to_value(&graph_arena, labels[idx]);
+    // MICROGRADC_TRACE=trace.json records a timeline for chrome://tracing
+    const char *trace_file = getenv("MICROGRADC_TRACE");
+    if (trace_file) {
+        trace_thread_name("main");
+        trace_open(trace_file);
+    }
 
-            // Forward pass 
-            Value **out = mlp_forward(&graph_arena, mlp, image, (size_t)size);
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+        printf("Epoch: %d\n", epoch);
+        double total_loss = 0;
 
-            // Loss
-            Value *loss = cross_entropy(&graph_arena, out, target, 10);
-            total_loss += loss->data;
+        for (int i = 0; i < sample_size; i += batch_size) {
+            trace_begin("step");
+            data.batch = batch_iter_next(batches);
 
-            // Backprop
-            value_backward(&graph_arena, loss);
+            // Forward + backward across the workers
+            total_loss += trainer_step(trainer, batch, data.batch->size, mnist_loss, &data) * data.batch->size;
 
             // Update
-            mlp_update(mlp, lr);
+            optim_step(opt);
 
             // Zero grad
             mlp_zero_grad(mlp);
-
-            // Reset graph arena for next sample
-            arena_reset(&graph_arena);
+            trace_end();
         }
 
         printf("Avg Loss: %.4f\n", total_loss / sample_size);
     }
 
+    // Join the workers and the prefetch thread before finishing the timeline
+    trainer_destroy(trainer);
+    batch_iter_destroy(batches);
+
+    if (trace_file) trace_close();
+
+    // Engine counters, only with make PROFILE=1
+    Profile prof;
+    if (profile_collect(&prof)) profile_print(stdout, &prof);
+
     mlp_save(mlp, "mnist.bin");
 
-    arena_free(&graph_arena);
+    dataset_close(train);
     arena_free(&param_arena);
     arena_free(&mnist_arena);
     return 0;
@@ -1,6 +1,7 @@
 #include "arena.h"
 #include "value.h"
 #include "nn.h"
+#include "tape.h"
 
 int main() {
     Arena param_arena = {0};
@@ -17,37 +18,42 @@ int main() {
     printf("\n");
 
     // XOR dataset (2-class)
-    double X[4][2] = {
+    mg_real X[4][2] = {
         {0.0, 0.0},
         {0.0, 1.0},
         {1.0, 0.0},
         {1.0, 1.0}
     };
-    double Y[4] = {0, 1, 1, 0};
+    mg_real Y[4] = {0, 1, 1, 0};
 
     int num_epochs = 5000;
     double learning_rate = 0.1;
 
+    // Build the graph once with placeholder inputs and target
+    Value **inputs = value_alloc_input(&param_arena, 2);
+    Value **target = value_alloc_input(&param_arena, 1);
+
+    Value **out = mlp_forward(&graph_arena, mlp, inputs, 2);
+    Value *loss = softmax_cross_entropy(&graph_arena, out, target[0], 2);
+
+    // Record it, then replay it for every sample. Every leaf besides the
+    // placeholders is a constant, so the optimizer may fold it
+    Tape *tape = tape_record(&graph_arena, loss);
+    tape_optimize(tape, NULL, 0);
+
     for (int epoch = 0; epoch < num_epochs; epoch++) {
         double total_loss = 0.0;
 
         for (int i = 0; i < 4; i++) {
-            arena_reset(&graph_arena);
-
-            // Inputs
-            Value *inputs[2];
-            inputs[0] = value_alloc(&graph_arena, X[i][0]);
-            inputs[1] = value_alloc(&graph_arena, X[i][1]);
-            Value *target = value_alloc(&graph_arena, Y[i]);
+            value_set_input(inputs, X[i], 2);
+            value_set_input(target, &Y[i], 1);
 
             // Forward
-            Value **out = mlp_forward(&graph_arena, mlp, inputs, 2);
-            Value *loss = cross_entropy(&graph_arena, out, target, 2);
-
+            tape_forward(tape);
             total_loss += loss->data;
 
             // Backward
-            value_backward(&graph_arena, loss);
+            tape_backward(tape);
 
             // Update parameters
             mlp_update(mlp, learning_rate);
@@ -61,10 +67,7 @@ int main() {
     printf("\n--- Final Results ---\n");
     for (int i = 0; i < 4; i++) {
         arena_reset(&graph_arena);
-
-        Value *inputs[2];
-        inputs[0] = value_alloc(&graph_arena, X[i][0]);
-        inputs[1] = value_alloc(&graph_arena, X[i][1]);
+        value_set_input(inputs, X[i], 2);
 
         Value **out = mlp_forward(&graph_arena, mlp, inputs, 2);
         Value **probs = soft_max(&graph_arena, out, 2);
@@ -1,6 +1,7 @@
 #include "arena.h"
 #include "value.h"
 #include "nn.h"
+#include "tape.h"
 
 int main(void) {
     Arena param_arena = {0};
@@ -17,42 +18,42 @@ int main(void) {
     printf("\n");
 
     // XOR dataset
-    double X[4][2] = {
+    mg_real X[4][2] = {
         {0.0, 0.0},
         {0.0, 1.0},
         {1.0, 0.0},
         {1.0, 1.0}
     };
-    double y[4] = {0.0, 1.0, 1.0, 0.0};
+    mg_real y[4] = {0.0, 1.0, 1.0, 0.0};
 
     int num_epochs = 1000;
     double learning_rate = 0.1;
 
+    // Build the graph once with placeholder inputs and target
+    Value **inputs = value_alloc_input(&param_arena, 2);
+    Value **target = value_alloc_input(&param_arena, 1);
+
+    Value **out = mlp_forward(&graph_arena, mlp, inputs, 2);
+    Value *loss = mse(&graph_arena, out, target, 1);
+
+    // Record it, then replay it for every sample. Every leaf besides the
+    // placeholders is a constant, so the optimizer may fold it
+    Tape *tape = tape_record(&graph_arena, loss);
+    tape_optimize(tape, NULL, 0);
+
     for (int epoch = 0; epoch < num_epochs; epoch++) {
         double total_loss = 0.0;
 
         for (int i = 0; i < 4; i++) {
-            arena_reset(&graph_arena);
-
-            // Prepare inputs
-            Value *inputs[2];
-            inputs[0] = value_alloc(&graph_arena, X[i][0]);
-            inputs[1] = value_alloc(&graph_arena, X[i][1]);
-            inputs[0]->value_kind = VALUE_INPUT;
-            inputs[1]->value_kind = VALUE_INPUT;
-
-            // Prepare target
-            Value *target = value_alloc(&graph_arena, y[i]);
-            Value *targets[1] = { target };
+            value_set_input(inputs, X[i], 2);
+            value_set_input(target, &y[i], 1);
 
             // Forward
-            Value **out = mlp_forward(&graph_arena, mlp, inputs, 2);
-            Value *loss = mse(&graph_arena, out, targets, 1);
-
+            tape_forward(tape);
             total_loss += loss->data;
 
             // Backward
-            value_backward(&graph_arena, loss);
+            tape_backward(tape);
 
             // Update parameters
             mlp_update(mlp, learning_rate);
@@ -65,13 +66,9 @@ int main(void) {
 
     printf("\n--- Final Results ---\n");
     for (int i = 0; i < 4; i++) {
-        arena_reset(&graph_arena);
-
-        Value *inputs[2];
-        inputs[0] = value_alloc(&graph_arena, X[i][0]);
-        inputs[1] = value_alloc(&graph_arena, X[i][1]);
+        value_set_input(inputs, X[i], 2);
 
-        Value **out = mlp_forward(&graph_arena, mlp, inputs, 2);
+        tape_forward(tape);
         printf("Input: [%.0f, %.0f] | Target: %.0f | Pred: %.4f\n",
                X[i][0], X[i][1], y[i], out[0]->data);
     }
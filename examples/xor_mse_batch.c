@@ -0,0 +1,69 @@
+#include "arena.h"
+#include "nn.h"
+
+int main(void) {
+    Arena param_arena = {0};
+    Arena batch_arena = {0};
+
+    // Define network architecture with Layer_Config
+    Layer_Config cfgs[2] = {
+        NN_LAYER_CFG(2, 2, ACT_TANH),
+        NN_LAYER_CFG(2, 1, ACT_LINEAR)
+    };
+
+    MLP *mlp = mlp_alloc(&param_arena, cfgs, 2);
+    mlp_print(mlp);
+    printf("\n");
+
+    // XOR dataset as one 4 x 2 batch
+    mg_real X[4 * 2] = {
+        0.0, 0.0,
+        0.0, 1.0,
+        1.0, 0.0,
+        1.0, 1.0
+    };
+    mg_real y[4] = {0.0, 1.0, 1.0, 0.0};
+
+    int num_epochs = 5000;
+    double learning_rate = 0.1;
+
+    for (int epoch = 0; epoch < num_epochs; epoch++) {
+        arena_reset(&batch_arena);
+
+        // Forward
+        Batch *bt = mlp_forward_batch(&batch_arena, mlp, X, 4);
+        mg_real *pred = bt->y[mlp->layer_size - 1];
+
+        // MSE per sample and its gradient w.r.t. the prediction
+        double total_loss = 0.0;
+        mg_real dy[4];
+        for (int i = 0; i < 4; i++) {
+            mg_real diff = pred[i] - y[i];
+            total_loss += diff * diff;
+            dy[i] = 2.0 * diff;
+        }
+
+        // Backward, gradients are averaged over the batch
+        mlp_backward_batch(&batch_arena, mlp, bt, dy);
+
+        // One update per batch
+        mlp_update(mlp, learning_rate);
+        mlp_zero_grad(mlp);
+
+        if (epoch % 500 == 0)
+            printf("Epoch %4d | Avg Loss: %.6f\n", epoch, total_loss / 4.0);
+    }
+
+    printf("\n--- Final Results ---\n");
+    arena_reset(&batch_arena);
+    Batch *bt = mlp_forward_batch(&batch_arena, mlp, X, 4);
+    mg_real *pred = bt->y[mlp->layer_size - 1];
+    for (int i = 0; i < 4; i++) {
+        printf("Input: [%.0f, %.0f] | Target: %.0f | Pred: %.4f\n",
+               X[i * 2], X[i * 2 + 1], y[i], pred[i]);
+    }
+
+    arena_free(&batch_arena);
+    arena_free(&param_arena);
+    return 0;
+}
@@ -16,37 +16,34 @@ int main(void) {
     printf("\n");
 
     // XOR dataset
-    double X[4][2] = {
+    mg_real X[4][2] = {
         {0.0, 0.0},
         {0.0, 1.0},
         {1.0, 0.0},
         {1.0, 1.0}
     };
-    double y[4] = {0.0, 1.0, 1.0, 0.0};
+    mg_real y[4] = {0.0, 1.0, 1.0, 0.0};
 
     int num_epochs = 5000;
     double learning_rate = 0.1;
 
+    // Inputs and target live next to the parameters and are refilled per sample
+    Value **inputs = value_alloc_input(&param_arena, 2);
+    Value **target = value_alloc_input(&param_arena, 1);
+
     for (int epoch = 0; epoch < num_epochs; epoch++) {
         double total_loss = 0.0;
 
         for (int i = 0; i < 4; i++) {
             arena_reset(&graph_arena);
 
-            // Prepare inputs
-            Value *inputs[2];
-            inputs[0] = value_alloc(&graph_arena, X[i][0]);
-            inputs[1] = value_alloc(&graph_arena, X[i][1]);
-            inputs[0]->value_kind = VALUE_INPUT;
-            inputs[1]->value_kind = VALUE_INPUT;
-
-            // Prepare target
-            Value *target = value_alloc(&graph_arena, y[i]);
-            Value *targets[1] = { target };
+            // Prepare inputs and target
+            value_set_input(inputs, X[i], 2);
+            value_set_input(target, &y[i], 1);
 
             // Forward
             Value **out = mlp_forward(&graph_arena, mlp, inputs, 2);
-            Value *loss = mse(&graph_arena, out, targets, 1);
+            Value *loss = mse(&graph_arena, out, target, 1);
 
             total_loss += loss->data;
 
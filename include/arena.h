@@ -66,10 +66,35 @@ typedef struct  {
 #define ARENA_REGION_DEFAULT_CAPACITY (8*1024)
 #endif // ARENA_REGION_DEFAULT_CAPACITY
 
+// Each new region is ARENA_REGION_GROWTH times the capacity of the one before it.
+// With growth enabled (> 1), arena_reset() keeps the largest region warm at the head
+// of the chain and hands the pages of the others back with release_region(). A working
+// set that outgrew the head makes arena_alloc() pass over those smaller regions and add
+// a larger one, which the next reset moves to the head in turn.
+#ifndef ARENA_REGION_GROWTH
+#define ARENA_REGION_GROWTH 1
+#endif // ARENA_REGION_GROWTH
+
+// ARENA_BACKEND_LINUX_MMAP only: try MAP_HUGETLB first (needs reserved huge pages),
+// otherwise regions of at least ARENA_HUGE_PAGE_SIZE are advised MADV_HUGEPAGE.
+#ifndef ARENA_MMAP_HUGETLB
+#define ARENA_MMAP_HUGETLB 0
+#endif // ARENA_MMAP_HUGETLB
+
+#ifndef ARENA_HUGE_PAGE_SIZE
+#define ARENA_HUGE_PAGE_SIZE (2*1024*1024)
+#endif // ARENA_HUGE_PAGE_SIZE
+
 Region *new_region(size_t capacity);
 void free_region(Region *r);
+// Give the region's memory back to the system but keep it usable (zeroed on next touch)
+void release_region(Region *r);
 
 void *arena_alloc(Arena *a, size_t size_bytes);
+// Bytes arena_alloc(a, size_bytes) takes from its region
+size_t arena_alloc_size(size_t size_bytes);
+// Make sure the next size_bytes of allocations fit in one region without creating another
+void arena_reserve(Arena *a, size_t size_bytes);
 void *arena_realloc(Arena *a, void *oldptr, size_t oldsz, size_t newsz);
 char *arena_strdup(Arena *a, const char *cstr);
 void *arena_memdup(Arena *a, void *data, size_t size);
@@ -166,6 +191,11 @@ void free_region(Region *r)
 {
     free(r);
 }
+
+void release_region(Region *r)
+{
+    (void) r;
+}
 #elif ARENA_BACKEND == ARENA_BACKEND_LINUX_MMAP
 #include <unistd.h>
 #include <sys/mman.h>
@@ -173,8 +203,25 @@ void free_region(Region *r)
 Region *new_region(size_t capacity)
 {
     size_t size_bytes = sizeof(Region) + sizeof(uintptr_t) * capacity;
-    Region *r = mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    ARENA_ASSERT(r != MAP_FAILED);
+    Region *r = MAP_FAILED;
+
+#if ARENA_MMAP_HUGETLB && defined(MAP_HUGETLB)
+    size_t huge_bytes = (size_bytes + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+    r = mmap(NULL, huge_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (r != MAP_FAILED) {
+        // The rounding is free, hand it to the region
+        capacity = (huge_bytes - sizeof(Region))/sizeof(uintptr_t);
+    }
+#endif
+
+    if (r == MAP_FAILED) {
+        r = mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        ARENA_ASSERT(r != MAP_FAILED);
+#ifdef MADV_HUGEPAGE
+        if (size_bytes >= ARENA_HUGE_PAGE_SIZE) madvise(r, size_bytes, MADV_HUGEPAGE);
+#endif
+    }
+
     r->next = NULL;
     r->count = 0;
     r->capacity = capacity;
@@ -188,6 +235,15 @@ void free_region(Region *r)
     ARENA_ASSERT(ret == 0);
 }
 
+void release_region(Region *r)
+{
+    // Whole pages past the header only, the header must survive
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)r->data + page - 1) & ~(page - 1);
+    uintptr_t end = (uintptr_t)(r->data + r->capacity) & ~(page - 1);
+    if (end > begin) madvise((void*)begin, end - begin, MADV_DONTNEED);
+}
+
 #elif ARENA_BACKEND == ARENA_BACKEND_WIN32_VIRTUALALLOC
 
 #if !defined(_WIN32)
@@ -234,6 +290,11 @@ void free_region(Region *r)
         ARENA_ASSERT(0 && "VirtualFreeEx() failed.");
 }
 
+void release_region(Region *r)
+{
+    (void) r;
+}
+
 #elif ARENA_BACKEND == ARENA_BACKEND_WASM_HEAPBASE
 
 // Stolen from https://surma.dev/things/c-to-webassembly/
@@ -281,6 +342,11 @@ void free_region(Region *r)
     (void) r;
 }
 
+void release_region(Region *r)
+{
+    (void) r;
+}
+
 #else
 #  error "Unknown Arena backend"
 #endif
@@ -303,15 +369,19 @@ void *arena_alloc(Arena *a, size_t size_bytes)
         a->begin = a->end;
     }
 
-    while (a->end->count + size > a->end->capacity && a->end->next != NULL) {
-        a->end = a->end->next;
-    }
-
-    if (a->end->count + size > a->end->capacity) {
-        ARENA_ASSERT(a->end->next == NULL);
+    while (a->end->count + size > a->end->capacity) {
         size_t capacity = ARENA_REGION_DEFAULT_CAPACITY;
+        if (ARENA_REGION_GROWTH > 1) capacity = a->end->capacity*ARENA_REGION_GROWTH;
         if (capacity < size) capacity = size;
-        a->end->next = new_region(capacity);
+
+        // Regions past the end are empty. With growth, the smaller ones arena_reset()
+        // released are passed over so the chain keeps growing towards the working set
+        Region *next = a->end->next;
+        if (next == NULL || (ARENA_REGION_GROWTH > 1 && next->capacity < capacity)) {
+            Region *r = new_region(capacity);
+            r->next = next;
+            a->end->next = r;
+        }
         a->end = a->end->next;
     }
 
@@ -320,6 +390,44 @@ void *arena_alloc(Arena *a, size_t size_bytes)
     return result;
 }
 
+size_t arena_alloc_size(size_t size_bytes)
+{
+    return (size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t)*sizeof(uintptr_t);
+}
+
+void arena_reserve(Arena *a, size_t size_bytes)
+{
+    size_t size = (size_bytes + sizeof(uintptr_t) - 1)/sizeof(uintptr_t);
+
+    if (a->end == NULL) {
+        ARENA_ASSERT(a->begin == NULL);
+        size_t capacity = ARENA_REGION_DEFAULT_CAPACITY;
+        if (capacity < size) capacity = size;
+        a->end = new_region(capacity);
+        a->begin = a->end;
+        return;
+    }
+
+    if (a->end->count + size <= a->end->capacity) return;
+
+    // Regions past the current one are empty, use one that is big enough
+    Region *prev = a->end, *r = a->end->next;
+    while (r != NULL && r->capacity < size) {
+        prev = r;
+        r = r->next;
+    }
+
+    if (r != NULL) {
+        prev->next = r->next;
+    } else {
+        // A region of exactly the requested size
+        r = new_region(size);
+    }
+    r->next = a->end->next;
+    a->end->next = r;
+    a->end = r;
+}
+
 void *arena_realloc(Arena *a, void *oldptr, size_t oldsz, size_t newsz)
 {
     if (newsz <= oldsz) return oldptr;
@@ -404,6 +512,28 @@ Arena_Mark arena_snapshot(Arena *a)
 
 void arena_reset(Arena *a)
 {
+#if ARENA_REGION_GROWTH > 1
+    if (a->begin != NULL) {
+        Region *largest = a->begin, *before_largest = NULL;
+        for (Region *prev = NULL, *r = a->begin; r != NULL; prev = r, r = r->next) {
+            if (r->capacity > largest->capacity) {
+                largest = r;
+                before_largest = prev;
+            }
+        }
+
+        // Keep the largest region warm at the head, release what spilled past it
+        if (before_largest != NULL) {
+            before_largest->next = largest->next;
+            largest->next = a->begin;
+            a->begin = largest;
+        }
+        for (Region *r = largest->next; r != NULL; r = r->next) {
+            if (r->count > 0) release_region(r);
+        }
+    }
+#endif // ARENA_REGION_GROWTH
+
     for (Region *r = a->begin; r != NULL; r = r->next) {
         r->count = 0;
     }
@@ -0,0 +1,63 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include "arena.h"
+#include "real.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Labelled dataset backed by a pair of IDX files (the MNIST format).
+ *
+ * Both files are mapped read-only and used in place: samples stay as raw
+ * unsigned bytes until a batch is staged, so opening 60k images costs two
+ * mmap calls instead of 60k reads.
+ */
+typedef struct Dataset Dataset;
+
+struct Dataset {
+    const uint8_t *x;       /* count x n_features, row-major */
+    const uint8_t *y;       /* count labels */
+    size_t count;
+    size_t rows, cols;      /* sample shape, n_features = rows * cols */
+    size_t n_features;
+
+    /* Mappings (or heap copies), released by dataset_close */
+    void *x_map, *y_map;
+    size_t x_map_size, y_map_size;
+};
+
+Dataset *dataset_open_idx(Arena *a, const char *x_file, const char *y_file);
+void dataset_close(Dataset *d);
+
+/* Sample i scaled from [0, 255] to [0, 1] into x (n_features) */
+void dataset_read(const Dataset *d, size_t i, mg_real *x);
+
+/**
+ * Shuffled mini-batches over a Dataset, staged by a background thread.
+ *
+ * Every epoch visits each sample once in a fresh random order; the last
+ * batch of an epoch may be short. Two staging buffers are kept: while the
+ * caller trains on one, the prefetch thread normalises the next batch into
+ * the other. A fixed seed gives the same sequence of batches on every run.
+ */
+typedef struct Data_Batch Data_Batch;
+
+struct Data_Batch {
+    size_t size;            /* B */
+    size_t epoch;
+    const mg_real *x;       /* B x n_features */
+    const size_t *y;        /* B labels */
+    const size_t *index;    /* B dataset positions */
+};
+
+typedef struct Batch_Iter Batch_Iter;
+
+Batch_Iter *batch_iter_create(Dataset *d, size_t batch_size, uint64_t seed);
+void batch_iter_destroy(Batch_Iter *it);
+
+/* Next batch; it stays valid until the following call */
+const Data_Batch *batch_iter_next(Batch_Iter *it);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "arena.h"
+#include "nn.h"
+#include "value.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Struct-of-arrays graph.
+ *
+ * Nodes are integer ids into parallel arrays instead of linked Values.
+ * A node can only refer to nodes created before it, so id order is already
+ * a topological order: forward is a sweep up the ids and backward a sweep
+ * down, each a single loop with a switch on the op.
+ *
+ * Unary ops leave in1 unused. Leaves (OP_NONE) keep their gradient across
+ * graph_backward() calls, like parameters in the Value graph; interior
+ * gradients are reset on every pass.
+ */
+typedef uint32_t Node_Id;
+
+typedef struct Graph Graph;
+
+struct Graph {
+    Arena *arena;   /* buffers grow here */
+
+    mg_real *data;
+    mg_real *grad;
+    uint8_t *op;    /* Op_Kind */
+    Node_Id *in0;
+    Node_Id *in1;
+
+    size_t count;
+    size_t capacity;
+};
+
+Graph *graph_alloc(Arena *a, size_t capacity);
+void graph_reset(Graph *g);
+
+Node_Id graph_leaf(Graph *g, mg_real data);
+Node_Id graph_add(Graph *g, Node_Id x, Node_Id y);
+Node_Id graph_sub(Graph *g, Node_Id x, Node_Id y);
+Node_Id graph_mul(Graph *g, Node_Id x, Node_Id y);
+Node_Id graph_div(Graph *g, Node_Id x, Node_Id y);
+Node_Id graph_pow(Graph *g, Node_Id x, Node_Id y);
+Node_Id graph_neg(Graph *g, Node_Id x);
+Node_Id graph_exp(Graph *g, Node_Id x);
+Node_Id graph_log(Graph *g, Node_Id x);
+Node_Id graph_tanh(Graph *g, Node_Id x);
+Node_Id graph_relu(Graph *g, Node_Id x);
+Node_Id graph_sigmoid(Graph *g, Node_Id x);
+Node_Id graph_square(Graph *g, Node_Id x);
+
+/*
+ * MLP on the graph, one node per multiply and add like neuron_forward().
+ * graph_mlp_params() adds a leaf for every parameter of m, laid out like
+ * m->params, and returns the first. graph_mlp_forward() returns the ids of
+ * the last layer's outputs in an array from g's arena. graph_mlp_grads()
+ * adds the parameter leaves' gradients into m->grads.
+ */
+Node_Id graph_mlp_params(Graph *g, const MLP *m);
+Node_Id *graph_mlp_forward(Graph *g, const MLP *m, Node_Id params, const Node_Id *x);
+Node_Id graph_mse(Graph *g, const Node_Id *pred, const Node_Id *target, size_t size);
+void graph_mlp_grads(const Graph *g, MLP *m, Node_Id params);
+
+/* Recompute every interior node from the current leaf data */
+void graph_forward(Graph *g);
+void graph_backward(Graph *g, Node_Id root);
+void graph_zero_grad(Graph *g);
+
+#endif
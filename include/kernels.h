@@ -0,0 +1,48 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "value.h"  /* mg_real, Act_Kind */
+
+#include <stddef.h>
+
+/**
+ * Dense vector kernels used by the layers and the optimizer.
+ *
+ * One table per instruction set (scalar, SSE2, AVX2+FMA, AVX-512). The best
+ * one the CPU supports is picked on first use; setting the environment
+ * variable MICROGRADC_KERNELS to a table name forces that table instead.
+ */
+typedef struct Kernels Kernels;
+
+struct Kernels {
+    const char *name;
+
+    /* sum(x[i] * y[i]) */
+    mg_real (*dot)(const mg_real *x, const mg_real *y, size_t n);
+    /* y += a * x */
+    void (*axpy)(mg_real a, const mg_real *x, mg_real *y, size_t n);
+    /* x *= a */
+    void (*scale)(mg_real a, mg_real *x, size_t n);
+    /* z = act(z), in place */
+    void (*act_forward)(Act_Kind act, mg_real *z, size_t n);
+    /* dy *= act'(z), with the derivative expressed through the output y */
+    void (*act_backward)(Act_Kind act, const mg_real *y, mg_real *dy, size_t n);
+
+    /*
+     * The update kernels step on g + wd * p, the L2 weight decay term, and
+     * leave g untouched.
+     */
+    /* v = mu * v + g; p -= lr * v */
+    void (*momentum)(mg_real mu, mg_real lr, mg_real wd, const mg_real *g, mg_real *v, mg_real *p, size_t n);
+    /*
+     * m = b1 * m + (1 - b1) * g; v = b2 * v + (1 - b2) * g^2;
+     * p -= lr * m / (sqrt(v) + eps). Bias correction is folded into lr and
+     * eps by the caller.
+     */
+    void (*adam)(mg_real b1, mg_real b2, mg_real lr, mg_real eps, mg_real wd,
+                 const mg_real *g, mg_real *m, mg_real *v, mg_real *p, size_t n);
+};
+
+const Kernels *kernels(void);
+
+#endif
@@ -22,15 +22,18 @@
         } \
     } while(0)
 
-typedef struct Neuron Neuron;
+/*
+ * Model file header: magic, version and the byte size of the stored reals.
+ * Version 2 stores all parameters as one block aligned to NN_FILE_ALIGN so
+ * it can be used straight from a mapping. Version 1
+ * files and files written before the header existed (doubles, starting
+ * with the layer count) are still read by mlp_load().
+ */
+#define NN_FILE_MAGIC   0x4E4E474Du     /* "MGNN" on disk */
+#define NN_FILE_VERSION 2u
+#define NN_FILE_ALIGN   64
 
-/* Activation kinds used by neurons or activation layers */
-typedef enum {
-    ACT_LINEAR,
-    ACT_TANH,
-    ACT_RELU,
-    ACT_SIGMOID
-} Act_Kind;
+typedef struct Neuron Neuron;
 
 /*
  * (n_in, 1)
@@ -46,17 +49,26 @@ struct Neuron {
 Neuron *neuron_alloc(Arena *a, size_t n_in, Act_Kind act);
 void neuron_print(Neuron *n);
 void neuron_zero_grad(Neuron *n);
+Value *neuron_forward(Arena *a, Neuron *n, Value **x, size_t x_size);
 
 typedef struct Layer Layer;
 
-/* (n_in, n_out) for linear, for activation layers n_in == n_out */
+/*
+ * (n_in, n_out)
+ * y = act_fn(W x + b), W is n_out x n_in
+ *
+ * Parameters are plain contiguous arrays rather than Values; the layer
+ * enters the graph as a single OP_DENSE node.
+ */
 struct Layer {
     Act_Kind act;
     size_t n_in;
     size_t n_out;
 
-    /* only used for linear layers */
-    Neuron **neurons;
+    mg_real *w;      /* row-major, row j holds the weights of output j */
+    mg_real *b;      /* length n_out */
+    mg_real *dw;     /* gradient of w */
+    mg_real *db;     /* gradient of b */
 };
 
 typedef struct Layer_Config Layer_Config;
@@ -69,20 +81,130 @@ struct Layer_Config {
 Layer *layer_alloc(Arena *a, Layer_Config *cfg);
 void layer_print(Layer *l);
 void layer_zero_grad(Layer *l);
+Value **layer_forward(Arena *a, Layer *l, Value **x, size_t x_size);
+
+/*
+ * One layer on raw arrays, one row per sample: Y = act(X W^T + b), and its
+ * backward, which rewrites dy into dZ in place and accumulates dW and db.
+ * dx may be NULL when the input gradient is not needed.
+ */
+void layer_forward_batch(Layer *l, const mg_real *x, mg_real *y, size_t batch_size);
+void layer_backward_batch(Layer *l, const mg_real *x, const mg_real *y, mg_real *dy, mg_real *dx, size_t batch_size);
+
+/*
+ * The layers a fused OP_DENSE or OP_CHECKPOINT node runs and the OP_OUTPUT
+ * nodes of the last one, for code lowering graphs. Returns the number of
+ * layers, 0 for any other node.
+ */
+size_t fused_layers(const Value *node, Layer ***layers, Value ***outputs);
 
 /* MLP */
+typedef struct Model_Map Model_Map;
+
 typedef struct MLP MLP;
 struct MLP {
     Layer **layers;
     size_t layer_size;
+
+    /*
+     * Every parameter in one block laid out [w0 b0 w1 b1 ...], gradients in
+     * a second block of the same shape. Layer w/b/dw/db point into them.
+     */
+    mg_real *params;
+    mg_real *grads;
+    size_t n_params;
+    size_t *offsets;    /* layer i starts at offsets[i], offsets[layer_size] == n_params */
+
+    /* Set when the weights live in a mapped file, see mlp_load_mmap */
+    Model_Map *map;
+
+    /* Ping-pong activation buffers for mlp_predict, widest layer output */
+    mg_real *act[2];
+};
+
+/*
+ * Activations of one mini-batch, kept by mlp_forward_batch() for
+ * mlp_backward_batch(). Matrices are row-major with one row per sample.
+ */
+typedef struct Batch Batch;
+struct Batch {
+    size_t size;        /* B */
+    const mg_real *x;    /* B x n_in input, borrowed from the caller */
+    mg_real **y;         /* y[i] is the B x n_out output of layer i */
+};
+
+/* Flat view of an MLP's parameters, see mlp_parameters() */
+typedef struct Params Params;
+struct Params {
+    mg_real *data;          /* size parameters, [w0 b0 w1 b1 ...] */
+    mg_real *grad;          /* their gradients, same layout */
+    size_t size;
+    const size_t *offsets;  /* w of layer i at offsets[i], its b n_in * n_out later */
 };
 
 MLP *mlp_alloc(Arena *a, Layer_Config *layer_configs, size_t config_size);
+Params mlp_parameters(MLP *m);
 void mlp_print(MLP *m);
 Value **mlp_forward(Arena *a, MLP *m, Value **x, size_t x_size);
+/*
+ * Gradient checkpointing: the same outputs as mlp_forward(), but every run
+ * of `every` layers enters the graph as one node that keeps only its input
+ * and output. The activations inside a run are recomputed when backward
+ * reaches it, so the graph grows with depth / every instead of depth, for
+ * one extra forward per run. every == 0 is mlp_forward().
+ */
+Value **mlp_forward_checkpoint(Arena *a, MLP *m, Value **x, size_t x_size, size_t every);
+Batch *mlp_forward_batch(Arena *a, MLP *m, const mg_real *x, size_t batch_size);
+void mlp_backward_batch(Arena *a, MLP *m, Batch *bt, const mg_real *dy);
 void mlp_zero_grad(MLP *m);
-void mlp_update(MLP *m, double lr);
+
+/*
+ * Inference on raw arrays without building a graph or allocating.
+ * Writes the output layer into out (if not NULL) and returns its argmax.
+ * Uses the MLP's own activation buffers, so one MLP must not predict from
+ * several threads at once.
+ */
+size_t mlp_predict(MLP *m, const mg_real *x, mg_real *out);
+/* x is B x n_in; out (B x n_out) and classes (B) may each be NULL */
+void mlp_predict_batch(MLP *m, const mg_real *x, size_t batch_size, mg_real *out, size_t *classes);
+void mlp_update(MLP *m, mg_real lr);
+
+/* Loss built on the outputs of mlp_forward(), for mlp_plan() */
+typedef enum {
+    LOSS_NONE,          /* forward only */
+    LOSS_MSE,           /* mse() against one target leaf per output */
+    LOSS_SOFTMAX_CE     /* softmax_cross_entropy() against one target leaf */
+} Loss_Kind;
+
+/*
+ * Exact graph arena usage of one training step: mlp_forward(), the loss and
+ * value_backward(). Input placeholders are counted as nodes but not bytes;
+ * leaves the caller allocates in the graph arena every step (e.g. targets
+ * made with value_alloc) are passed as step_leaves.
+ */
+typedef struct Graph_Plan Graph_Plan;
+struct Graph_Plan {
+    size_t n_nodes;         /* nodes reached by value_backward */
+    size_t forward_bytes;   /* graph, kept until the arena is reset */
+    size_t backward_bytes;  /* sort scratch, released when backward returns */
+    size_t total_bytes;     /* peak, arena_reserve() this much */
+};
+
+Graph_Plan mlp_plan(const MLP *m, Loss_Kind loss, size_t step_leaves);
+/* Same for a graph built by mlp_forward_checkpoint(), every == 0 is mlp_plan() */
+Graph_Plan mlp_plan_checkpoint(const MLP *m, Loss_Kind loss, size_t step_leaves, size_t every);
+
 int mlp_save(MLP *m, const char *filename);
 MLP *mlp_load(Arena *a, const char *filename);
 
+/*
+ * Map a version 2 file and point the layer weights straight into it.
+ * The mapping is private, so processes share the page cache until one of
+ * them writes (trains); gradients live in an anonymous mapping. Files of
+ * another version or precision fall back to a copying mlp_load().
+ * mlp_unmap() releases the mappings; the MLP must not be used afterwards.
+ */
+MLP *mlp_load_mmap(Arena *a, const char *filename);
+void mlp_unmap(MLP *m);
+
 #endif
@@ -0,0 +1,65 @@
+#ifndef OPTIM_H
+#define OPTIM_H
+
+#include "arena.h"
+#include "nn.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OPTIM_SGD_CFG(lr_val) \
+    ((Optim_Config){ .kind = OPTIM_SGD, .lr = (lr_val) })
+#define OPTIM_MOMENTUM_CFG(lr_val, momentum_val) \
+    ((Optim_Config){ .kind = OPTIM_MOMENTUM, .lr = (lr_val), .momentum = (momentum_val) })
+#define OPTIM_ADAM_CFG(lr_val) \
+    ((Optim_Config){ .kind = OPTIM_ADAM, .lr = (lr_val), .beta1 = 0.9, .beta2 = 0.999, .eps = 1e-8 })
+#define OPTIM_ADAMW_CFG(lr_val, weight_decay_val) \
+    ((Optim_Config){ .kind = OPTIM_ADAMW, .lr = (lr_val), .beta1 = 0.9, .beta2 = 0.999, .eps = 1e-8, \
+                     .weight_decay = (weight_decay_val) })
+
+typedef enum {
+    OPTIM_SGD,
+    OPTIM_MOMENTUM,
+    OPTIM_ADAM,
+    OPTIM_ADAMW     /* Adam with decoupled weight decay */
+} Optim_Kind;
+
+/*
+ * weight_decay is an L2 term added to the gradient for SGD, momentum and
+ * Adam, and a direct p *= 1 - lr * weight_decay shrink for AdamW. Either way
+ * the MLP's gradients are left as the backward pass wrote them.
+ */
+typedef struct Optim_Config Optim_Config;
+struct Optim_Config {
+    Optim_Kind kind;
+    mg_real lr;
+    mg_real momentum;
+    mg_real beta1, beta2, eps;
+    mg_real weight_decay;
+};
+
+/**
+ * Optimizer over the flat parameter view of an MLP (mlp_parameters).
+ *
+ * State (velocity, first and second moments) is kept in arrays laid out in
+ * the same order, one entry per parameter, so a step is a single kernel
+ * sweep over the whole model instead of a walk over individual weights.
+ * Call optim_step() where mlp_update() would be called.
+ */
+typedef struct Optimizer Optimizer;
+
+struct Optimizer {
+    Optim_Config cfg;
+    MLP *mlp;
+    size_t n_params;
+    uint64_t t;         /* steps taken, for Adam's bias correction */
+
+    mg_real *m;         /* velocity (momentum) or first moment (Adam) */
+    mg_real *v;         /* second moment (Adam) */
+};
+
+Optimizer *optim_alloc(Arena *a, MLP *m, Optim_Config cfg);
+void optim_step(Optimizer *o);
+void optim_reset(Optimizer *o);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "arena.h"
+#include "value.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Autograd engine counters, built in with -DMG_PROFILE=1 (make PROFILE=1).
+ *
+ * Counts the Values created per Op_Kind, the graph arena bytes in use when
+ * value_backward() starts and the scratch it takes on top, and splits the
+ * ticks of value_backward() into the topological sort and the gradient
+ * propagation. Backward time per op kind is measured on one node call in
+ * MG_PROFILE_SAMPLE and scaled up by the call count.
+ *
+ * Every thread counts into its own block, so the trainer's workers don't
+ * contend; profile_collect() sums the blocks and should run while no graph
+ * is being built or differentiated. Without MG_PROFILE the hooks compile to
+ * nothing and profile_collect() returns false.
+ */
+
+#ifndef MG_PROFILE
+#define MG_PROFILE 0
+#endif
+
+#ifndef MG_PROFILE_SAMPLE
+#define MG_PROFILE_SAMPLE 8
+#endif
+
+#define MG_OP_COUNT (OP_OUTPUT + 1)
+
+typedef struct Profile Profile;
+struct Profile {
+    uint64_t nodes[MG_OP_COUNT];            /* Values created, leaves under OP_NONE */
+
+    uint64_t backward_calls[MG_OP_COUNT];   /* node backward() calls */
+    uint64_t backward_sampled[MG_OP_COUNT]; /* calls that were timed */
+    uint64_t backward_ticks[MG_OP_COUNT];   /* ticks of the timed calls */
+
+    uint64_t passes;                        /* value_backward() calls */
+    uint64_t sorted_nodes;                  /* nodes reached, summed over passes */
+    uint64_t topo_ticks;
+    uint64_t propagate_ticks;
+
+    uint64_t graph_bytes;                   /* arena bytes in use at the start of a pass, summed */
+    uint64_t graph_bytes_max;
+    uint64_t scratch_bytes;                 /* sort scratch on top of the graph, summed */
+    uint64_t scratch_bytes_max;
+};
+
+/* Sum of every thread's counters into out. Returns false when built without MG_PROFILE */
+bool profile_collect(Profile *out);
+void profile_reset(void);
+
+/*
+ * Human-readable summary: nodes and estimated backward ticks per op kind,
+ * sort vs propagation share and bytes per pass.
+ */
+void profile_print(FILE *f, const Profile *p);
+
+const char *profile_tick_unit(void);
+
+/* Hooks for the engine */
+
+Profile *profile_local(void);
+uint64_t profile_ticks(void);
+size_t profile_arena_bytes(const Arena *a);
+
+#if MG_PROFILE
+/* value_alloc() counts every node as a leaf, builders move it to their op */
+#define MG_PROFILE_NODE(op) \
+    do { Profile *_p = profile_local(); _p->nodes[OP_NONE]--; _p->nodes[(op)]++; } while (0)
+#define MG_PROFILE_LEAVES(n) (profile_local()->nodes[OP_NONE] += (n))
+#else
+#define MG_PROFILE_NODE(op) ((void)0)
+#define MG_PROFILE_LEAVES(n) ((void)0)
+#endif
+
+#endif
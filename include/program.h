@@ -0,0 +1,155 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "arena.h"
+#include "nn.h"
+#include "value.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Graph compiled to a linear register program.
+ *
+ * program_compile() lowers the DAG under a root into one instruction per
+ * interior node, in topological order, over a flat register file:
+ *
+ *   [inputs][params][constants][interior nodes]
+ *
+ * Inputs are refilled by the caller (program_set_inputs), params are read
+ * from their Values at the start of every forward and receive their
+ * gradients back after every backward, and any other leaf is frozen as a
+ * constant. Fused layer nodes (OP_DENSE, OP_CHECKPOINT) become one
+ * instruction running their layers on a scratch buffer, their outputs a
+ * block of consecutive registers; the weights are used in place and their
+ * gradients accumulate into the layers as usual.
+ *
+ * The reverse schedule keeps only the instructions with an input that
+ * depends on a parameter or a layer, so nothing is differentiated with
+ * respect to inputs or constants.
+ *
+ * Before lowering, the graph is simplified: nodes over constants only are
+ * folded, x + 0, x * 1, x - 0, x / 1 and x ^ 1 become x, pow(x, 2) becomes
+ * a square, repeated subexpressions are computed once and nodes the root
+ * no longer reads are dropped. The program computes the same values as
+ * the graph with fewer and cheaper instructions.
+ */
+
+#define PROGRAM_FILE_MAGIC   0x5250474Du    /* "MGPR" on disk */
+#define PROGRAM_FILE_VERSION 2u
+
+typedef uint32_t Reg;
+
+/* Instruction flags, set from the reverse schedule */
+#define PROGRAM_GRAD_IN 0x01    /* layer run: scatter gradients back to its inputs */
+#define PROGRAM_GRAD_A  0x02    /* operand a needs its gradient */
+#define PROGRAM_GRAD_B  0x04    /* operand b needs its gradient */
+
+typedef struct Program_Instr Program_Instr;
+struct Program_Instr {
+    uint8_t op;     /* Op_Kind, the opcode */
+    uint8_t flags;
+    Reg dst;        /* result, or the first of a layer run's outputs */
+    Reg a, b;       /* operands; variable arity ops keep theirs in args[a..] */
+    uint32_t n;     /* operand count or layer run */
+    uint32_t buf;   /* offset of the instruction's scratch */
+};
+
+/* Layers of one fused node, run_layers[first .. first + count) index layers[] */
+typedef struct Program_Run Program_Run;
+struct Program_Run {
+    uint32_t first;
+    uint32_t count;
+};
+
+/*
+ * Native forward and backward of one program, see program_jit(). w holds
+ * [w b dw db] of every entry of p->layers, refreshed before each call.
+ * forward returns -1 on a softmax target out of range, 0 otherwise.
+ */
+typedef int Program_Forward_Fn(mg_real *d, mg_real *buf, mg_real *const *w);
+typedef void Program_Backward_Fn(const mg_real *d, mg_real *g, const mg_real *buf, mg_real *g0, mg_real *g1, mg_real *const *w);
+
+typedef struct Program_Jit Program_Jit;
+struct Program_Jit {
+    void *handle;                   /* dlopen() handle of the shared object */
+    Program_Forward_Fn *forward;
+    Program_Backward_Fn *backward;
+    mg_real **w;                    /* 4 * n_layers */
+};
+
+typedef struct Program Program;
+struct Program {
+    size_t n_regs;
+    size_t n_inputs, n_params, n_consts;
+    Reg root;
+
+    mg_real *data;       /* n_regs */
+    mg_real *grad;       /* n_regs */
+    Value **params;     /* bound parameter Values, one per param register */
+
+    Program_Instr *code;        /* forward schedule */
+    size_t n_code;
+    uint32_t *reverse;          /* code indices in backward order */
+    size_t n_reverse;
+
+    Reg *args;                  /* operands of variable arity instructions */
+    size_t n_args;
+
+    Layer **layers;             /* distinct layers the program runs */
+    size_t n_layers;
+    uint32_t *run_layers;
+    size_t n_run_layers;
+    Program_Run *runs;
+    size_t n_runs;
+
+    mg_real *buf;                /* per instruction scratch */
+    size_t buf_size;
+    mg_real *g[2];               /* layer gradient ping-pong, widest layer */
+    size_t width;
+
+    Program_Jit *jit;           /* native code, NULL while interpreted */
+};
+
+/*
+ * Compile the graph under root. inputs and params must be leaves; the
+ * program's input and param registers follow their order. Leaf data is
+ * copied into the registers, so the program is ready to run.
+ */
+Program *program_compile(Arena *a, Value *root, Value **inputs, size_t n_inputs, Value **params, size_t n_params);
+
+/* Copy n_inputs values into the input registers */
+void program_set_inputs(Program *p, const mg_real *x);
+
+/* Forward over the whole schedule, returns the root */
+mg_real program_forward(Program *p);
+/* Gradients of the last forward into the params and layers, accumulated */
+void program_backward(Program *p);
+/* Both, returns the root */
+mg_real program_run(Program *p);
+
+/*
+ * The compiled form without any weights. program_load() binds it again:
+ * layers in the order of p->layers (m->layers for an MLP graph) and the
+ * param Values in compile order, checking shapes and counts.
+ */
+int program_save(const Program *p, const char *filename);
+Program *program_load(Arena *a, const char *filename, Layer **layers, size_t n_layers, Value **params, size_t n_params);
+
+/*
+ * Optional JIT: emits C specialized for this program (register numbers,
+ * constants and layer shapes baked in, loops with fixed trip counts for the
+ * compiler to unroll and vectorize), builds it into a shared object with
+ * the system compiler and loads it with dlopen(). program_forward() and
+ * program_backward() then run the native code.
+ *
+ * The compiler is $MICROGRADC_CC, or cc, run without a shell. Its flags are
+ * $MICROGRADC_JIT_CFLAGS, or -O3 -march=native -fopenmp-simd, split on
+ * whitespace; -fPIC -shared is always added. Returns 0 on success; on -1 (no
+ * compiler, build or load failure) the program stays on the interpreter.
+ * program_jit_free() unloads the code and goes back to interpreting.
+ */
+int program_jit(Program *p);
+void program_jit_free(Program *p);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef REAL_H
+#define REAL_H
+
+/**
+ * Scalar type of every value, gradient and parameter.
+ *
+ * double by default; build with -DMG_REAL_FLOAT=1 (make PRECISION=float)
+ * for float32, which halves memory traffic and doubles the SIMD width.
+ * The library and the code using it must agree on this setting.
+ */
+#if defined(MG_REAL_FLOAT) && MG_REAL_FLOAT
+typedef float mg_real;
+#define MG_REAL_IS_FLOAT 1
+#else
+typedef double mg_real;
+#define MG_REAL_IS_FLOAT 0
+#endif
+
+#define MG_REAL_SIZE ((unsigned)sizeof(mg_real))
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include "arena.h"
+#include "value.h"
+
+#include <stddef.h>
+
+/**
+ * Record-once / replay-many program for graphs with a fixed topology.
+ *
+ * tape_record() flattens the graph under root into its interior nodes in
+ * topological order. Afterwards the graph is kept alive and reused: write
+ * new data into the leaf Values (inputs, targets), then tape_forward()
+ * recomputes every node in place and tape_backward() propagates gradients,
+ * without allocating or sorting again.
+ *
+ * Only graphs whose shape does not depend on the data can be replayed, and
+ * choices made from the data while building are replayed as they were:
+ *
+ *   - cross_entropy() picks the target term by the target's data at build
+ *     time, so its target must not change between replays.
+ *   - cross_entropy() and soft_max() subtract the logit that was largest
+ *     when the graph was built. The shift cancels, so replayed values and
+ *     gradients stay correct, but once another logit becomes the largest
+ *     by a wide margin exp() can overflow to inf and the loss to NaN.
+ *
+ * softmax_cross_entropy() reads the target and finds the max on every
+ * forward and has neither restriction; prefer it for replayed losses.
+ */
+typedef struct Tape Tape;
+
+struct Tape {
+    Value *root;
+    Value **nodes;  /* interior nodes, inputs before consumers */
+    size_t n_nodes;
+};
+
+Tape *tape_record(Arena *a, Value *root);
+
+/**
+ * Simplify a recorded graph in place, like program_compile() does, so that
+ * tape_forward() and tape_backward() replay less:
+ *
+ *   - constants: leaves that are neither in vars nor inputs or params (see
+ *     Value_Kind), and any node whose operands are all constant, keep the
+ *     data they were built with and leave the tape. Equal constants are
+ *     shared and no gradient is pushed into them.
+ *   - identities: x + 0, 0 + x, x - 0, x * 1, 1 * x, x / 1 and x ^ 1 are x
+ *   - pow(x, 2) becomes a square
+ *   - the same op on the same operands is computed once
+ *
+ * vars lists any other leaf whose data changes between replays or that
+ * needs a gradient, such as parameters made with value_alloc().
+ * Consumers are rewired to the replacements. The root and the outputs of
+ * fused layers are always replayed, a node that was replaced keeps its
+ * build-time data.
+ */
+void tape_optimize(Tape *t, Value **vars, size_t n_vars);
+
+void tape_forward(Tape *t);
+void tape_backward(Tape *t);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+/**
+ * Timeline of a run in Chrome trace-event JSON, for chrome://tracing or
+ * Perfetto.
+ *
+ * The library marks its phases (graph build, loss, backward, update, arena
+ * reset, batch loading, ...) with trace_begin()/trace_end() pairs. They cost
+ * one flag check until trace_open() starts a recording; from then on every
+ * pair becomes a complete event on the calling thread's track. Events are
+ * buffered per thread and written to the file as the buffers fill, so the
+ * hot path never takes a lock.
+ *
+ * Other threads may keep running traced work across trace_open() and
+ * trace_close(): trace_close() waits for spans being written to finish and
+ * drops those still open.
+ */
+
+/* Start recording into path, truncating it. Returns 0 on success, -1 on error */
+int trace_open(const char *path);
+/* Flush every thread's events and finish the file */
+void trace_close(void);
+bool trace_enabled(void);
+
+/*
+ * Open and close a span on the calling thread. name must stay valid until
+ * trace_close() (string literals); spans nest up to TRACE_MAX_DEPTH deep.
+ */
+void trace_begin(const char *name);
+void trace_end(void);
+
+/* Label the calling thread's track, e.g. "trainer worker 2". Can be set before trace_open() */
+void trace_thread_name(const char *name);
+
+#define TRACE_MAX_DEPTH 32
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef TRAINER_H
+#define TRAINER_H
+
+#include "arena.h"
+#include "value.h"
+#include "nn.h"
+
+#include <stddef.h>
+
+/**
+ * Data-parallel mini-batch trainer.
+ *
+ * A batch is split across n_threads workers (the calling thread is worker 0).
+ * Every worker owns a graph Arena and a replica of the MLP that shares the
+ * weights but accumulates gradients into its own buffer, so gradient memory
+ * is n_threads x n_params whatever the batch size. Worker k always takes the
+ * k-th contiguous chunk of the batch in order, and the worker buffers are
+ * summed with a pairwise tree in worker order, so a fixed seed and thread
+ * count give bit-identical results. Different thread counts round differently.
+ */
+
+/**
+ * Build the loss of one sample into a, using m (a replica) for the forward
+ * pass. x is the worker's input placeholder, n_in of the first layer wide and
+ * kept across samples and steps: fill it with value_set_input() rather than
+ * allocating new input leaves. x[n_in] is one more placeholder of the same
+ * kind for a scalar target.
+ */
+typedef Value *(*Sample_Loss_Fn)(Arena *a, MLP *m, Value **x, size_t sample, void *user);
+
+typedef struct Trainer Trainer;
+
+Trainer *trainer_create(MLP *m, size_t n_threads, size_t max_batch);
+void trainer_destroy(Trainer *t);
+
+/* Pre-size every worker's graph arena, typically to mlp_plan().total_bytes */
+void trainer_reserve(Trainer *t, size_t bytes);
+
+/**
+ * Run forward and backward for every sample of the batch and add the mean
+ * gradient to the MLP's gradients, ready for mlp_update().
+ * Returns the mean loss.
+ */
+mg_real trainer_step(Trainer *t, const size_t *samples, size_t batch_size, Sample_Loss_Fn fn, void *user);
+
+#endif
@@ -2,9 +2,11 @@
 #define VALUE_H
 
 #include "arena.h"
+#include "real.h"
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
 typedef enum Op_Kind {
@@ -19,13 +21,28 @@ typedef enum Op_Kind {
     OP_LOG,
     OP_NEG,
     OP_SIGMOID,
-    OP_RELU
+    OP_RELU,
+    OP_SQUARE,  /* x * x, what pow(x, 2) is rewritten to */
+    OP_DOT_BIAS,/* fused sum(w[i] * x[i]) + b */
+    OP_DENSE,   /* fused layer, one node for a whole W x + b */
+    OP_CHECKPOINT, /* fused run of layers, recomputed during backward */
+    OP_SOFTMAX_CE, /* fused softmax + cross-entropy loss */
+    OP_OUTPUT   /* one element of a multi-output node (prev[0]) */
 } Op_Kind;
 
+/* Activation kinds used by neurons or activation layers */
+typedef enum {
+    ACT_LINEAR,
+    ACT_TANH,
+    ACT_RELU,
+    ACT_SIGMOID
+} Act_Kind;
+
 typedef struct Value Value;
 
 /**
- * Just for visualization
+ * For visualization, and tape_optimize() takes inputs and params as the
+ * leaves that change between replays
  */
 typedef enum Value_Kind {
     VALUE_PARAM,
@@ -35,22 +52,29 @@ typedef enum Value_Kind {
 } Value_Kind;
 
 struct Value {
-    double data;
-    double grad; 
+    mg_real data;
+    mg_real grad; 
 
     Value **prev;
     size_t n_prev;
 
+    void (*forward)(Value *v);
     void (*backward)(Value *v);
     
     Op_Kind op;
 
+    /* Op-specific payload for fused nodes */
+    void *ctx;
+
+    /* Last value_backward pass that reached this node */
+    uint64_t gen;
+
     // Visualization only
     Value_Kind value_kind;
     char label[32];
 };
 
-Value *value_alloc(Arena *a, double data);
+Value *value_alloc(Arena *a, mg_real data);
 Value *value_add(Arena *a, Value *v1, Value *v2);
 Value *value_sub(Arena *a, Value *v1, Value *v2);
 Value *value_neg(Arena *a, Value *v1);
@@ -59,16 +83,70 @@ Value *value_div(Arena *a, Value *v1, Value *v2);
 Value *value_exp(Arena *a, Value *v1);
 Value *value_log(Arena *a, Value *v1);
 Value *value_pow(Arena *a, Value *v1, Value *v2);
+Value *value_square(Arena *a, Value *v1);
 Value *value_tanh(Arena *a, Value *v1);
 Value *value_relu(Arena *a, Value *v1);
 Value *value_sigmoid(Arena *a, Value *v1);
+Value *value_dot_bias(Arena *a, Value **w, Value **x, size_t n, Value *b);
+
+/**
+ * Input placeholders: n leaf Values allocated once, typically next to the
+ * parameters, and refilled in place every step. Graphs built on top of them
+ * only need the graph arena for computed nodes.
+ * value_set_input() copies data into the leaves and clears their gradients.
+ */
+Value **value_alloc_input(Arena *a, size_t n);
+void value_set_input(Value **in, const mg_real *data, size_t n);
 
 void value_backward(Arena *a, Value *v);
 
+/**
+ * Every node reachable from root, inputs before the nodes that consume them.
+ * The array is allocated in a and *n receives its length.
+ */
+Value **value_topo_sort(Arena *a, Value *root, size_t *n);
+
+/**
+ * In-place rewrites for graph passes such as tape_optimize().
+ * value_rewrite_square() turns pow(x, 2) into x * x over its first operand.
+ * value_stop_grad() makes the backward of a binary node skip operand k
+ * (0 or 1), for an operand that is a constant.
+ */
+void value_rewrite_square(Value *v);
+void value_stop_grad(Value *v, size_t k);
+
 Value **soft_max(Arena *a, Value **logits, size_t size);
 Value *mse(Arena *a, Value **pred, Value **target, size_t size);
 Value *cross_entropy(Arena *a, Value **pred, Value *target, size_t size);
 
+/**
+ * Fused softmax + cross-entropy: one node for the whole loss.
+ * The target index is read on every forward, so the node can be replayed
+ * by a Tape with a different label. Backward writes p - onehot(target)
+ * straight into the logit gradients.
+ */
+Value *softmax_cross_entropy(Arena *a, Value **logits, Value *target, size_t size);
+
+/**
+ * Same loss over a B x size matrix of logits without building a graph.
+ * Writes the per-sample gradient p - onehot into dlogits (B x size) and
+ * returns the mean loss. mlp_backward_batch() does the batch averaging.
+ */
+mg_real softmax_cross_entropy_batch(const mg_real *logits, const size_t *targets, size_t batch_size, size_t size, mg_real *dlogits);
+
+/**
+ * Graph arena bytes taken by the builders above, for memory planning.
+ * value_backward_bytes() is the scratch of one value_backward() over a graph
+ * of n_nodes reachable nodes whose deepest path holds depth nodes; it is
+ * released again when value_backward() returns.
+ */
+size_t value_bytes(size_t n);
+size_t mse_bytes(size_t size);
+size_t softmax_cross_entropy_bytes(size_t size);
+size_t value_backward_bytes(size_t n_nodes, size_t depth);
+
+const char *op_to_string(Op_Kind op);
+
 // void print_dag(Value *root);
 void export_dag_png(Value *root, const char *filename);
 
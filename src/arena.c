@@ -1,2 +1,18 @@
+#define _DEFAULT_SOURCE
+
+/*
+ * Arena configuration of the library, see ARENA in the Makefile.
+ * MG_ARENA_MMAP: mmap-backed regions growing geometrically, huge page
+ * friendly, with arena_reset() keeping the largest region warm.
+ * MG_ARENA_HUGETLB additionally tries explicit huge pages first.
+ */
+#if defined(MG_ARENA_MMAP) && defined(__linux__)
+#define ARENA_BACKEND ARENA_BACKEND_LINUX_MMAP
+#define ARENA_REGION_GROWTH 2
+#if defined(MG_ARENA_HUGETLB)
+#define ARENA_MMAP_HUGETLB 1
+#endif
+#endif
+
 #define ARENA_IMPLEMENTATION
-#include "arena.h"
\ No newline at end of file
+#include "arena.h"
@@ -0,0 +1,348 @@
+#define _DEFAULT_SOURCE
+#include "dataset.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define IDX_TYPE_UBYTE 0x08
+
+/* Whole file, mapped where possible */
+static void *file_map(const char *filename, size_t *size) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+
+    /* Batches are drawn in random order, don't read ahead */
+    madvise(p, (size_t)st.st_size, MADV_RANDOM);
+
+    *size = (size_t)st.st_size;
+    return p;
+#else
+    FILE *f = fopen(filename, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    void *p = n > 0 ? malloc((size_t)n) : NULL;
+    if (!p || fread(p, 1, (size_t)n, f) != (size_t)n) {
+        free(p);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    *size = (size_t)n;
+    return p;
+#endif
+}
+
+static void file_unmap(void *p, size_t size) {
+    if (!p) return;
+#if defined(__unix__) || defined(__APPLE__)
+    munmap(p, size);
+#else
+    (void)size;
+    free(p);
+#endif
+}
+
+static uint32_t read_be_u32(const uint8_t *b) {
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+/*
+ * IDX header: two zero bytes, the element type, the number of dimensions,
+ * then one big-endian u32 per dimension. Only unsigned byte data is used.
+ * Returns the first byte of data or NULL if the file does not hold
+ * n_dims dimensions of that type.
+ */
+static const uint8_t *idx_parse(const uint8_t *base, size_t size, size_t n_dims, size_t *dims) {
+    if (size < 4 || base[0] != 0 || base[1] != 0 || base[2] != IDX_TYPE_UBYTE || base[3] != n_dims) {
+        return NULL;
+    }
+
+    size_t header = 4 + 4 * n_dims;
+    if (size < header) return NULL;
+
+    size_t total = 1;
+    for (size_t i = 0; i < n_dims; ++i) {
+        dims[i] = read_be_u32(base + 4 + 4 * i);
+        // A product that wraps could pass the size check below
+        if (dims[i] && total > SIZE_MAX / dims[i]) return NULL;
+        total *= dims[i];
+    }
+    if (size - header < total) return NULL;
+
+    return base + header;
+}
+
+Dataset *dataset_open_idx(Arena *a, const char *x_file, const char *y_file) {
+    size_t x_size = 0, y_size = 0;
+    void *x_map = file_map(x_file, &x_size);
+    if (!x_map) {
+        perror(x_file);
+        return NULL;
+    }
+
+    void *y_map = file_map(y_file, &y_size);
+    if (!y_map) {
+        perror(y_file);
+        file_unmap(x_map, x_size);
+        return NULL;
+    }
+
+    size_t x_dims[3], y_dims[1];
+    const uint8_t *x = idx_parse(x_map, x_size, 3, x_dims);
+    const uint8_t *y = idx_parse(y_map, y_size, 1, y_dims);
+
+    if (!x || !y) {
+        fprintf(stderr, "dataset_open_idx: invalid IDX file %s\n", !x ? x_file : y_file);
+    } else if (x_dims[0] != y_dims[0]) {
+        fprintf(stderr, "dataset_open_idx: %zu samples but %zu labels\n", x_dims[0], y_dims[0]);
+        x = NULL;
+    }
+
+    if (!x || !y) {
+        file_unmap(x_map, x_size);
+        file_unmap(y_map, y_size);
+        return NULL;
+    }
+
+    Dataset *d = arena_alloc(a, sizeof(Dataset));
+    d->x = x;
+    d->y = y;
+    d->count = x_dims[0];
+    d->rows = x_dims[1];
+    d->cols = x_dims[2];
+    d->n_features = d->rows * d->cols;
+    d->x_map = x_map;
+    d->x_map_size = x_size;
+    d->y_map = y_map;
+    d->y_map_size = y_size;
+    return d;
+}
+
+void dataset_close(Dataset *d) {
+    file_unmap(d->x_map, d->x_map_size);
+    file_unmap(d->y_map, d->y_map_size);
+    d->x_map = NULL;
+    d->y_map = NULL;
+    d->x = NULL;
+    d->y = NULL;
+}
+
+void dataset_read(const Dataset *d, size_t i, mg_real *x) {
+    const uint8_t *src = d->x + i * d->n_features;
+    for (size_t k = 0; k < d->n_features; ++k) {
+        x[k] = (mg_real)src[k] / 255;
+    }
+}
+
+/* Batch iterator */
+
+typedef struct {
+    Data_Batch batch;
+    mg_real *x;
+    size_t *y;
+    size_t *index;
+    bool ready;     /* staged and not yet released by the consumer */
+} Slot;
+
+struct Batch_Iter {
+    Dataset *d;
+    size_t batch_size;
+
+    /* Producer state, only touched by the prefetch thread */
+    size_t *order;
+    size_t pos;
+    size_t epoch;
+    uint64_t rng;
+
+    Slot slots[2];
+    size_t next;        /* slot handed out by the next batch_iter_next */
+    Slot *held;         /* slot the consumer is working on */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool quit;
+};
+
+/* splitmix64, so a seed fully determines the batch sequence */
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static void shuffle(size_t *order, size_t n, uint64_t *rng) {
+    for (size_t i = n; i > 1; --i) {
+        size_t j = (size_t)(rng_next(rng) % i);
+        size_t tmp = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = tmp;
+    }
+}
+
+static void stage(Batch_Iter *it, Slot *s) {
+    Dataset *d = it->d;
+
+    if (it->pos == d->count) {
+        it->pos = 0;
+        it->epoch++;
+        shuffle(it->order, d->count, &it->rng);
+    }
+
+    size_t n = d->count - it->pos;
+    if (n > it->batch_size) n = it->batch_size;
+
+    for (size_t i = 0; i < n; ++i) {
+        size_t idx = it->order[it->pos + i];
+        s->index[i] = idx;
+        s->y[i] = d->y[idx];
+        dataset_read(d, idx, &s->x[i * d->n_features]);
+    }
+
+    s->batch.size = n;
+    s->batch.epoch = it->epoch;
+    it->pos += n;
+}
+
+static void *prefetch_main(void *arg) {
+    Batch_Iter *it = arg;
+    trace_thread_name("batch prefetch");
+
+    for (size_t k = 0;; k ^= 1) {
+        Slot *s = &it->slots[k];
+
+        pthread_mutex_lock(&it->lock);
+        while (s->ready && !it->quit) pthread_cond_wait(&it->cond, &it->lock);
+        bool quit = it->quit;
+        pthread_mutex_unlock(&it->lock);
+        if (quit) break;
+
+        trace_begin("load batch");
+        stage(it, s);
+        trace_end();
+
+        pthread_mutex_lock(&it->lock);
+        s->ready = true;
+        pthread_cond_broadcast(&it->cond);
+        pthread_mutex_unlock(&it->lock);
+    }
+    return NULL;
+}
+
+Batch_Iter *batch_iter_create(Dataset *d, size_t batch_size, uint64_t seed) {
+    if (d->count == 0 || batch_size == 0) {
+        fprintf(stderr, "batch_iter_create: empty dataset or batch\n");
+        return NULL;
+    }
+
+    Batch_Iter *it = calloc(1, sizeof(*it));
+    if (!it) return NULL;
+
+    it->d = d;
+    it->batch_size = batch_size;
+    it->rng = seed;
+    it->order = malloc(sizeof(size_t) * d->count);
+
+    bool ok = it->order != NULL;
+    for (size_t k = 0; k < 2; ++k) {
+        Slot *s = &it->slots[k];
+        s->x = malloc(sizeof(mg_real) * batch_size * d->n_features);
+        s->y = malloc(sizeof(size_t) * batch_size);
+        s->index = malloc(sizeof(size_t) * batch_size);
+        s->batch.x = s->x;
+        s->batch.y = s->y;
+        s->batch.index = s->index;
+        ok = ok && s->x && s->y && s->index;
+    }
+
+    if (!ok) {
+        for (size_t k = 0; k < 2; ++k) {
+            free(it->slots[k].x);
+            free(it->slots[k].y);
+            free(it->slots[k].index);
+        }
+        free(it->order);
+        free(it);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < d->count; ++i) it->order[i] = i;
+    shuffle(it->order, d->count, &it->rng);
+
+    pthread_mutex_init(&it->lock, NULL);
+    pthread_cond_init(&it->cond, NULL);
+
+    if (pthread_create(&it->thread, NULL, prefetch_main, it) != 0) {
+        fprintf(stderr, "batch_iter_create: failed to start prefetch thread\n");
+        exit(1);
+    }
+    return it;
+}
+
+void batch_iter_destroy(Batch_Iter *it) {
+    pthread_mutex_lock(&it->lock);
+    it->quit = true;
+    pthread_cond_broadcast(&it->cond);
+    pthread_mutex_unlock(&it->lock);
+    pthread_join(it->thread, NULL);
+
+    pthread_mutex_destroy(&it->lock);
+    pthread_cond_destroy(&it->cond);
+
+    for (size_t k = 0; k < 2; ++k) {
+        free(it->slots[k].x);
+        free(it->slots[k].y);
+        free(it->slots[k].index);
+    }
+    free(it->order);
+    free(it);
+}
+
+const Data_Batch *batch_iter_next(Batch_Iter *it) {
+    pthread_mutex_lock(&it->lock);
+
+    // Hand the previous buffer back to the prefetch thread
+    if (it->held) {
+        it->held->ready = false;
+        pthread_cond_broadcast(&it->cond);
+    }
+
+    Slot *s = &it->slots[it->next];
+    trace_begin("wait batch");
+    while (!s->ready) pthread_cond_wait(&it->cond, &it->lock);
+    trace_end();
+    it->held = s;
+    it->next ^= 1;
+
+    pthread_mutex_unlock(&it->lock);
+    return &s->batch;
+}
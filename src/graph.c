@@ -0,0 +1,234 @@
+#include "graph.h"
+
+#include <tgmath.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Graph *graph_alloc(Arena *a, size_t capacity) {
+    if (capacity == 0) capacity = 64;
+
+    Graph *g = arena_alloc(a, sizeof(Graph));
+    g->arena = a;
+    g->data = arena_alloc(a, sizeof(mg_real) * capacity);
+    g->grad = arena_alloc(a, sizeof(mg_real) * capacity);
+    g->op = arena_alloc(a, sizeof(uint8_t) * capacity);
+    g->in0 = arena_alloc(a, sizeof(Node_Id) * capacity);
+    g->in1 = arena_alloc(a, sizeof(Node_Id) * capacity);
+    g->count = 0;
+    g->capacity = capacity;
+    return g;
+}
+
+void graph_reset(Graph *g) {
+    g->count = 0;
+}
+
+static void graph_grow(Graph *g) {
+    Arena *a = g->arena;
+    size_t old = g->capacity;
+    size_t cap = old * 2;
+
+    g->data = arena_realloc(a, g->data, sizeof(mg_real) * old, sizeof(mg_real) * cap);
+    g->grad = arena_realloc(a, g->grad, sizeof(mg_real) * old, sizeof(mg_real) * cap);
+    g->op = arena_realloc(a, g->op, sizeof(uint8_t) * old, sizeof(uint8_t) * cap);
+    g->in0 = arena_realloc(a, g->in0, sizeof(Node_Id) * old, sizeof(Node_Id) * cap);
+    g->in1 = arena_realloc(a, g->in1, sizeof(Node_Id) * old, sizeof(Node_Id) * cap);
+    g->capacity = cap;
+}
+
+static mg_real graph_eval(const Graph *g, Op_Kind op, Node_Id x, Node_Id y) {
+    const mg_real *d = g->data;
+
+    switch (op) {
+        case OP_ADD:     return d[x] + d[y];
+        case OP_SUB:     return d[x] - d[y];
+        case OP_MUL:     return d[x] * d[y];
+        case OP_DIV:     return d[x] / d[y];
+        case OP_POW:     return pow(d[x], d[y]);
+        case OP_NEG:     return -d[x];
+        case OP_EXP:     return exp(d[x]);
+        case OP_LOG:     return log(d[x]);
+        case OP_TANH:    return tanh(d[x]);
+        case OP_RELU:    return d[x] < 0 ? 0 : d[x];
+        case OP_SIGMOID: return 1 / (1 + exp(-d[x]));
+        case OP_SQUARE:  return d[x] * d[x];
+        default:
+            fprintf(stderr, "graph: unsupported op %d\n", (int)op);
+            exit(1);
+    }
+}
+
+static Node_Id graph_push(Graph *g, Op_Kind op, Node_Id x, Node_Id y, mg_real data) {
+    if (g->count == g->capacity) {
+        graph_grow(g);
+    }
+
+    Node_Id id = (Node_Id)g->count++;
+    g->op[id] = (uint8_t)op;
+    g->in0[id] = x;
+    g->in1[id] = y;
+    g->data[id] = data;
+    g->grad[id] = 0.0;
+    return id;
+}
+
+static Node_Id graph_binary(Graph *g, Op_Kind op, Node_Id x, Node_Id y) {
+    return graph_push(g, op, x, y, graph_eval(g, op, x, y));
+}
+
+static Node_Id graph_unary(Graph *g, Op_Kind op, Node_Id x) {
+    return graph_push(g, op, x, x, graph_eval(g, op, x, x));
+}
+
+Node_Id graph_leaf(Graph *g, mg_real data) {
+    return graph_push(g, OP_NONE, 0, 0, data);
+}
+
+Node_Id graph_add(Graph *g, Node_Id x, Node_Id y) { return graph_binary(g, OP_ADD, x, y); }
+Node_Id graph_sub(Graph *g, Node_Id x, Node_Id y) { return graph_binary(g, OP_SUB, x, y); }
+Node_Id graph_mul(Graph *g, Node_Id x, Node_Id y) { return graph_binary(g, OP_MUL, x, y); }
+Node_Id graph_div(Graph *g, Node_Id x, Node_Id y) { return graph_binary(g, OP_DIV, x, y); }
+Node_Id graph_pow(Graph *g, Node_Id x, Node_Id y) { return graph_binary(g, OP_POW, x, y); }
+Node_Id graph_neg(Graph *g, Node_Id x)            { return graph_unary(g, OP_NEG, x); }
+Node_Id graph_exp(Graph *g, Node_Id x)            { return graph_unary(g, OP_EXP, x); }
+Node_Id graph_log(Graph *g, Node_Id x)            { return graph_unary(g, OP_LOG, x); }
+Node_Id graph_tanh(Graph *g, Node_Id x)           { return graph_unary(g, OP_TANH, x); }
+Node_Id graph_relu(Graph *g, Node_Id x)           { return graph_unary(g, OP_RELU, x); }
+Node_Id graph_sigmoid(Graph *g, Node_Id x)        { return graph_unary(g, OP_SIGMOID, x); }
+Node_Id graph_square(Graph *g, Node_Id x)         { return graph_unary(g, OP_SQUARE, x); }
+
+Node_Id graph_mlp_params(Graph *g, const MLP *m) {
+    Node_Id first = (Node_Id)g->count;
+    for (size_t i = 0; i < m->n_params; ++i) {
+        graph_leaf(g, m->params[i]);
+    }
+    return first;
+}
+
+static Node_Id graph_act(Graph *g, Act_Kind act, Node_Id x) {
+    switch (act) {
+        case ACT_TANH:    return graph_tanh(g, x);
+        case ACT_RELU:    return graph_relu(g, x);
+        case ACT_SIGMOID: return graph_sigmoid(g, x);
+        case ACT_LINEAR:
+        default:          return x;
+    }
+}
+
+Node_Id *graph_mlp_forward(Graph *g, const MLP *m, Node_Id params, const Node_Id *x) {
+    const Node_Id *in = x;
+    Node_Id *out = NULL;
+
+    for (size_t i = 0; i < m->layer_size; ++i) {
+        const Layer *l = m->layers[i];
+        Node_Id w = params + (Node_Id)m->offsets[i];
+        Node_Id b = w + (Node_Id)(l->n_in * l->n_out);
+
+        out = arena_alloc(g->arena, sizeof(Node_Id) * l->n_out);
+        for (size_t j = 0; j < l->n_out; ++j) {
+            Node_Id row = w + (Node_Id)(j * l->n_in);
+            Node_Id sum = graph_mul(g, row, in[0]);
+            for (size_t k = 1; k < l->n_in; ++k) {
+                sum = graph_add(g, sum, graph_mul(g, row + (Node_Id)k, in[k]));
+            }
+            out[j] = graph_act(g, l->act, graph_add(g, sum, b + (Node_Id)j));
+        }
+        in = out;
+    }
+    return out;
+}
+
+Node_Id graph_mse(Graph *g, const Node_Id *pred, const Node_Id *target, size_t size) {
+    Node_Id sum = graph_square(g, graph_sub(g, pred[0], target[0]));
+    for (size_t i = 1; i < size; ++i) {
+        sum = graph_add(g, sum, graph_square(g, graph_sub(g, pred[i], target[i])));
+    }
+    return graph_div(g, sum, graph_leaf(g, (mg_real)size));
+}
+
+void graph_mlp_grads(const Graph *g, MLP *m, Node_Id params) {
+    for (size_t i = 0; i < m->n_params; ++i) {
+        m->grads[i] += g->grad[params + i];
+    }
+}
+
+void graph_forward(Graph *g) {
+    for (size_t i = 0; i < g->count; ++i) {
+        Op_Kind op = (Op_Kind)g->op[i];
+        if (op == OP_NONE) continue;
+        g->data[i] = graph_eval(g, op, g->in0[i], g->in1[i]);
+    }
+}
+
+/* Same rules as the backward_* functions in value.c */
+void graph_backward(Graph *g, Node_Id root) {
+    mg_real *data = g->data;
+    mg_real *grad = g->grad;
+
+    for (size_t i = 0; i <= root; ++i) {
+        if (g->op[i] != OP_NONE) grad[i] = 0.0;
+    }
+    grad[root] = 1.0;
+
+    for (size_t i = (size_t)root + 1; i-- > 0;) {
+        Node_Id x = g->in0[i];
+        Node_Id y = g->in1[i];
+        mg_real d = grad[i];
+
+        switch ((Op_Kind)g->op[i]) {
+            case OP_ADD:
+                grad[x] += d;
+                grad[y] += d;
+                break;
+            case OP_SUB:
+                grad[x] += d;
+                grad[y] -= d;
+                break;
+            case OP_MUL:
+                grad[x] += data[y] * d;
+                grad[y] += data[x] * d;
+                break;
+            case OP_DIV:
+                grad[x] += (1 / data[y]) * d;
+                grad[y] += (-data[x] / (data[y] * data[y])) * d;
+                break;
+            case OP_POW:
+                grad[x] += data[y] * pow(data[x], data[y] - 1) * d;
+                if (data[x] > 0) {
+                    grad[y] += data[i] * log(data[x]) * d;
+                } else {
+                    grad[y] = NAN;
+                }
+                break;
+            case OP_NEG:
+                grad[x] -= d;
+                break;
+            case OP_EXP:
+                grad[x] += data[i] * d;
+                break;
+            case OP_LOG:
+                grad[x] += (1 / data[x]) * d;
+                break;
+            case OP_TANH:
+                grad[x] += (1 - data[i] * data[i]) * d;
+                break;
+            case OP_RELU:
+                if (data[x] > 0) grad[x] += d;
+                break;
+            case OP_SIGMOID:
+                grad[x] += data[i] * (1 - data[i]) * d;
+                break;
+            case OP_SQUARE:
+                grad[x] += 2 * data[x] * d;
+                break;
+            case OP_NONE:
+            default:
+                break;
+        }
+    }
+}
+
+void graph_zero_grad(Graph *g) {
+    memset(g->grad, 0, sizeof(mg_real) * g->count);
+}
@@ -0,0 +1,522 @@
+#define _DEFAULT_SOURCE
+#include "program.h"
+#include "trace.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * The generated file is standalone C: registers are d[], gradients g[],
+ * constants are inlined as hex float literals and every loop bound is a
+ * literal, so the compiler is free to unroll and vectorize. Layer dot
+ * products are marked as simd reductions, which lets them be reordered
+ * like the SIMD kernels do.
+ */
+
+#define JIT_CC_DEFAULT     "cc"
+#define JIT_CFLAGS_DEFAULT "-O3 -march=native -fopenmp-simd"
+
+static bool is_const(const Program *p, Reg r) {
+    size_t first = p->n_inputs + p->n_params;
+    return r >= first && r < first + p->n_consts;
+}
+
+/* Inputs and constants never need their gradient */
+static bool no_grad(const Program *p, Reg r) {
+    return r < p->n_inputs || is_const(p, r);
+}
+
+/* Operand r as an expression, buf holds at least 48 chars */
+static const char *reg(char *buf, const Program *p, Reg r) {
+    if (is_const(p, r) && isfinite((double)p->data[r])) {
+        snprintf(buf, 48, "((mg_real)%a)", (double)p->data[r]);
+    } else {
+        snprintf(buf, 48, "d[%u]", r);
+    }
+    return buf;
+}
+
+static void emit_grad(FILE *f, const Program *p, Reg r, const char *op, const char *expr) {
+    if (no_grad(p, r)) return;
+    fprintf(f, "        g[%u] %s %s;\n", r, op, expr);
+}
+
+static bool contiguous(const Reg *r, size_t n) {
+    for (size_t i = 1; i < n; ++i) {
+        if (r[i] != r[0] + i) return false;
+    }
+    return true;
+}
+
+static bool is_binary(uint8_t op) {
+    return op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV || op == OP_POW;
+}
+
+/* Ops whose a (and b) are registers, the others index args[] with a */
+static bool is_scalar(uint8_t op) {
+    return is_binary(op) || op == OP_NEG || op == OP_EXP || op == OP_LOG || op == OP_TANH ||
+           op == OP_RELU || op == OP_SIGMOID || op == OP_SQUARE;
+}
+
+/* Gradient into operand a or b of a scalar instruction, per its flags */
+static void emit_grad_ab(FILE *f, const Program_Instr *in, uint8_t flag, const char *op, const char *expr) {
+    if (!(in->flags & flag)) return;
+    fprintf(f, "        g[%u] %s %s;\n", flag == PROGRAM_GRAD_A ? in->a : in->b, op, expr);
+}
+
+static const char *act_expr(Act_Kind act) {
+    switch (act) {
+        case ACT_TANH:    return "tanh(s)";
+        case ACT_SIGMOID: return "1 / (1 + exp(-s))";
+        case ACT_RELU:    return "s < 0 ? 0 : s";
+        case ACT_LINEAR:
+        default:          return "s";
+    }
+}
+
+static Layer *run_layer(const Program *p, const Program_Run *r, size_t i, size_t *index) {
+    *index = p->run_layers[r->first + i];
+    return p->layers[*index];
+}
+
+/*
+ * Input x and output y of layer i of a run. Contiguous inputs are read from
+ * the registers in place, anything else is gathered into the scratch like
+ * the interpreter does. The last layer writes straight into its output
+ * registers, the others after the gathered inputs in the scratch.
+ */
+static void run_io(const Program *p, const Program_Instr *in, size_t n_in, size_t i, char *x, char *y) {
+    const Program_Run *r = &p->runs[in->n];
+    const Reg *args = &p->args[in->a];
+
+    size_t off = in->buf + n_in;
+    for (size_t k = 0; k + 1 < i; ++k) {
+        size_t index;
+        off += run_layer(p, r, k, &index)->n_out;
+    }
+
+    if (i > 0) {
+        snprintf(x, 48, "buf + %zu", off);
+    } else if (contiguous(args, n_in)) {
+        snprintf(x, 48, "d + %u", args[0]);
+    } else {
+        snprintf(x, 48, "buf + %u", in->buf);
+    }
+
+    if (i + 1 == r->count) {
+        snprintf(y, 48, "d + %u", in->dst);
+    } else {
+        size_t index;
+        snprintf(y, 48, "buf + %zu", i > 0 ? off + run_layer(p, r, i - 1, &index)->n_out : off);
+    }
+}
+
+static void emit_run_forward(FILE *f, const Program *p, const Program_Instr *in) {
+    const Program_Run *r = &p->runs[in->n];
+    const Reg *args = &p->args[in->a];
+    size_t index;
+    size_t n_in = run_layer(p, r, 0, &index)->n_in;
+
+    char x[48], y[48];
+    if (!contiguous(args, n_in)) {
+        char ra[48];
+        for (size_t i = 0; i < n_in; ++i) {
+            fprintf(f, "        buf[%zu] = %s;\n", in->buf + i, reg(ra, p, args[i]));
+        }
+    }
+
+    for (size_t i = 0; i < r->count; ++i) {
+        Layer *l = run_layer(p, r, i, &index);
+        run_io(p, in, n_in, i, x, y);
+        fprintf(f, "        {\n");
+        fprintf(f, "            const mg_real *W = w[%zu], *B = w[%zu];\n", 4 * index, 4 * index + 1);
+        fprintf(f, "            const mg_real *x = %s;\n", x);
+        fprintf(f, "            mg_real *y = %s;\n", y);
+        fprintf(f, "            for (size_t j = 0; j < %zu; ++j) {\n", l->n_out);
+        fprintf(f, "                mg_real s = 0;\n");
+        fprintf(f, "                _Pragma(\"omp simd reduction(+:s)\")\n");
+        fprintf(f, "                for (size_t i = 0; i < %zu; ++i) s += W[j * %zu + i] * x[i];\n", l->n_in, l->n_in);
+        fprintf(f, "                s += B[j];\n");
+        fprintf(f, "                y[j] = %s;\n", act_expr(l->act));
+        fprintf(f, "            }\n");
+        fprintf(f, "        }\n");
+    }
+}
+
+static void emit_run_backward(FILE *f, const Program *p, const Program_Instr *in) {
+    const Program_Run *r = &p->runs[in->n];
+    const Reg *args = &p->args[in->a];
+    size_t index;
+    size_t n_in = run_layer(p, r, 0, &index)->n_in;
+    size_t n_out = run_layer(p, r, r->count - 1, &index)->n_out;
+
+    char x[48], y[48];
+    fprintf(f, "        for (size_t j = 0; j < %zu; ++j) g0[j] = g[%u + j];\n", n_out, in->dst);
+
+    const char *gy = "g0", *gx = "g1";
+    for (size_t i = r->count; i-- > 0;) {
+        Layer *l = run_layer(p, r, i, &index);
+        bool dx = i > 0 || (in->flags & PROGRAM_GRAD_IN);
+        run_io(p, in, n_in, i, x, y);
+
+        fprintf(f, "        {\n");
+        fprintf(f, "            const mg_real *W = w[%zu];\n", 4 * index);
+        fprintf(f, "            mg_real *dW = w[%zu], *dB = w[%zu];\n", 4 * index + 2, 4 * index + 3);
+        fprintf(f, "            const mg_real *x = %s, *y = %s;\n", x, y);
+        switch (l->act) {
+            case ACT_TANH:
+                fprintf(f, "            for (size_t j = 0; j < %zu; ++j) %s[j] *= 1 - y[j] * y[j];\n", l->n_out, gy);
+                break;
+            case ACT_SIGMOID:
+                fprintf(f, "            for (size_t j = 0; j < %zu; ++j) %s[j] *= y[j] * (1 - y[j]);\n", l->n_out, gy);
+                break;
+            case ACT_RELU:
+                fprintf(f, "            for (size_t j = 0; j < %zu; ++j) %s[j] = y[j] > 0 ? %s[j] : 0;\n", l->n_out, gy, gy);
+                break;
+            case ACT_LINEAR:
+            default:
+                fprintf(f, "            (void)y;\n");
+                break;
+        }
+        fprintf(f, "            for (size_t j = 0; j < %zu; ++j) {\n", l->n_out);
+        fprintf(f, "                const mg_real dz = %s[j];\n", gy);
+        fprintf(f, "                for (size_t i = 0; i < %zu; ++i) dW[j * %zu + i] += dz * x[i];\n", l->n_in, l->n_in);
+        fprintf(f, "                dB[j] += dz;\n");
+        fprintf(f, "            }\n");
+        if (dx) {
+            fprintf(f, "            for (size_t i = 0; i < %zu; ++i) %s[i] = 0;\n", l->n_in, gx);
+            fprintf(f, "            for (size_t j = 0; j < %zu; ++j) {\n", l->n_out);
+            fprintf(f, "                const mg_real dz = %s[j];\n", gy);
+            fprintf(f, "                for (size_t i = 0; i < %zu; ++i) %s[i] += dz * W[j * %zu + i];\n", l->n_in, gx, l->n_in);
+            fprintf(f, "            }\n");
+        } else {
+            fprintf(f, "            (void)W;\n");
+        }
+        fprintf(f, "        }\n");
+
+        const char *t = gy;
+        gy = gx;
+        gx = t;
+    }
+
+    if (in->flags & PROGRAM_GRAD_IN) {
+        if (contiguous(args, n_in)) {
+            if (!no_grad(p, args[0]) || !no_grad(p, args[n_in - 1])) {
+                fprintf(f, "        for (size_t i = 0; i < %zu; ++i) g[%u + i] += %s[i];\n", n_in, args[0], gy);
+            }
+        } else {
+            char e[64];
+            for (size_t i = 0; i < n_in; ++i) {
+                snprintf(e, sizeof(e), "%s[%zu]", gy, i);
+                emit_grad(f, p, args[i], "+=", e);
+            }
+        }
+    }
+}
+
+static void emit_forward(FILE *f, const Program *p) {
+    char ra[48], rb[48];
+
+    fprintf(f, "int mg_program_forward(mg_real *restrict d, mg_real *restrict buf, mg_real *const *w) {\n");
+    fprintf(f, "    (void)buf; (void)w;\n");
+
+    for (size_t k = 0; k < p->n_code; ++k) {
+        const Program_Instr *in = &p->code[k];
+        const char *A = is_scalar(in->op) ? reg(ra, p, in->a) : NULL;
+        const char *B = is_binary(in->op) ? reg(rb, p, in->b) : NULL;
+
+        fprintf(f, "    { /* %zu: %s */\n", k, op_to_string((Op_Kind)in->op));
+        switch ((Op_Kind)in->op) {
+            case OP_ADD:     fprintf(f, "        d[%u] = %s + %s;\n", in->dst, A, B); break;
+            case OP_SUB:     fprintf(f, "        d[%u] = %s - %s;\n", in->dst, A, B); break;
+            case OP_MUL:     fprintf(f, "        d[%u] = %s * %s;\n", in->dst, A, B); break;
+            case OP_DIV:     fprintf(f, "        d[%u] = %s / %s;\n", in->dst, A, B); break;
+            case OP_POW:     fprintf(f, "        d[%u] = pow(%s, %s);\n", in->dst, A, B); break;
+            case OP_NEG:     fprintf(f, "        d[%u] = -%s;\n", in->dst, A); break;
+            case OP_EXP:     fprintf(f, "        d[%u] = exp(%s);\n", in->dst, A); break;
+            case OP_LOG:     fprintf(f, "        d[%u] = log(%s);\n", in->dst, A); break;
+            case OP_TANH:    fprintf(f, "        d[%u] = tanh(%s);\n", in->dst, A); break;
+            case OP_RELU:    fprintf(f, "        d[%u] = %s < 0 ? 0 : %s;\n", in->dst, A, A); break;
+            case OP_SIGMOID: fprintf(f, "        d[%u] = 1 / (1 + exp(-%s));\n", in->dst, A); break;
+            case OP_SQUARE:  fprintf(f, "        d[%u] = %s * %s;\n", in->dst, A, A); break;
+            case OP_DOT_BIAS: {
+                const Reg *wr = &p->args[in->a];
+                const Reg *xr = wr + in->n;
+                fprintf(f, "        mg_real s = 0;\n");
+                for (size_t i = 0; i < in->n; ++i) {
+                    fprintf(f, "        s += %s * %s;\n", reg(ra, p, wr[i]), reg(rb, p, xr[i]));
+                }
+                fprintf(f, "        d[%u] = s + %s;\n", in->dst, reg(ra, p, xr[in->n]));
+                break;
+            }
+            case OP_SOFTMAX_CE: {
+                const Reg *z = &p->args[in->a];
+                fprintf(f, "        mg_real *z = buf + %u, *q = z + %u;\n", in->buf, in->n);
+                for (size_t i = 0; i < in->n; ++i) {
+                    fprintf(f, "        z[%zu] = %s;\n", i, reg(ra, p, z[i]));
+                }
+                fprintf(f, "        const mg_real t = %s;\n", reg(ra, p, in->b));
+                fprintf(f, "        if (t < 0 || (size_t)t >= %u) return -1;\n", in->n);
+                fprintf(f, "        const size_t target = (size_t)t;\n");
+                fprintf(f, "        mg_real max = z[0], sum = 0;\n");
+                fprintf(f, "        for (size_t i = 1; i < %u; ++i) if (z[i] > max) max = z[i];\n", in->n);
+                fprintf(f, "        for (size_t i = 0; i < %u; ++i) { q[i] = exp(z[i] - max); sum += q[i]; }\n", in->n);
+                fprintf(f, "        for (size_t i = 0; i < %u; ++i) q[i] /= sum;\n", in->n);
+                fprintf(f, "        d[%u] = log(sum) - (z[target] - max);\n", in->dst);
+                fprintf(f, "        q[target] -= 1;\n");
+                break;
+            }
+            case OP_DENSE:
+            case OP_CHECKPOINT:
+                emit_run_forward(f, p, in);
+                break;
+            default:
+                break;
+        }
+        fprintf(f, "    }\n");
+    }
+    fprintf(f, "    return 0;\n");
+    fprintf(f, "}\n\n");
+}
+
+static void emit_backward(FILE *f, const Program *p) {
+    char ra[48], rb[48], e[160];
+
+    fprintf(f, "void mg_program_backward(const mg_real *restrict d, mg_real *restrict g, const mg_real *restrict buf,\n");
+    fprintf(f, "                         mg_real *restrict g0, mg_real *restrict g1, mg_real *const *w) {\n");
+    fprintf(f, "    (void)d; (void)buf; (void)g0; (void)g1; (void)w;\n");
+
+    for (size_t r = 0; r < p->n_reverse; ++r) {
+        const Program_Instr *in = &p->code[p->reverse[r]];
+        const char *A = is_scalar(in->op) ? reg(ra, p, in->a) : NULL;
+        const char *B = is_binary(in->op) ? reg(rb, p, in->b) : NULL;
+        Reg y = in->dst;
+
+        fprintf(f, "    { /* %u: %s */\n", p->reverse[r], op_to_string((Op_Kind)in->op));
+        fprintf(f, "        const mg_real gd = g[%u]; (void)gd;\n", y);
+        switch ((Op_Kind)in->op) {
+            case OP_ADD:
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", "gd");
+                emit_grad_ab(f, in, PROGRAM_GRAD_B, "+=", "gd");
+                break;
+            case OP_SUB:
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", "gd");
+                emit_grad_ab(f, in, PROGRAM_GRAD_B, "-=", "gd");
+                break;
+            case OP_MUL:
+                snprintf(e, sizeof(e), "%s * gd", B);
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", e);
+                snprintf(e, sizeof(e), "%s * gd", A);
+                emit_grad_ab(f, in, PROGRAM_GRAD_B, "+=", e);
+                break;
+            case OP_DIV:
+                snprintf(e, sizeof(e), "(1 / %s) * gd", B);
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", e);
+                snprintf(e, sizeof(e), "(-%s / (%s * %s)) * gd", A, B, B);
+                emit_grad_ab(f, in, PROGRAM_GRAD_B, "+=", e);
+                break;
+            case OP_POW:
+                snprintf(e, sizeof(e), "%s * pow(%s, %s - 1) * gd", B, A, B);
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", e);
+                if (in->flags & PROGRAM_GRAD_B) {
+                    fprintf(f, "        if (%s > 0) g[%u] += d[%u] * log(%s) * gd; else g[%u] = NAN;\n", A, in->b, y, A, in->b);
+                }
+                break;
+            case OP_NEG:
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "-=", "gd");
+                break;
+            case OP_EXP:
+                snprintf(e, sizeof(e), "d[%u] * gd", y);
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", e);
+                break;
+            case OP_LOG:
+                snprintf(e, sizeof(e), "(1 / %s) * gd", A);
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", e);
+                break;
+            case OP_TANH:
+                snprintf(e, sizeof(e), "(1 - d[%u] * d[%u]) * gd", y, y);
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", e);
+                break;
+            case OP_RELU:
+                if (in->flags & PROGRAM_GRAD_A) fprintf(f, "        if (%s > 0) g[%u] += gd;\n", A, in->a);
+                break;
+            case OP_SIGMOID:
+                snprintf(e, sizeof(e), "d[%u] * (1 - d[%u]) * gd", y, y);
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", e);
+                break;
+            case OP_SQUARE:
+                snprintf(e, sizeof(e), "2 * %s * gd", A);
+                emit_grad_ab(f, in, PROGRAM_GRAD_A, "+=", e);
+                break;
+            case OP_DOT_BIAS: {
+                const Reg *wr = &p->args[in->a];
+                const Reg *xr = wr + in->n;
+                for (size_t i = 0; i < in->n; ++i) {
+                    snprintf(e, sizeof(e), "%s * gd", reg(ra, p, xr[i]));
+                    emit_grad(f, p, wr[i], "+=", e);
+                    snprintf(e, sizeof(e), "%s * gd", reg(rb, p, wr[i]));
+                    emit_grad(f, p, xr[i], "+=", e);
+                }
+                emit_grad(f, p, xr[in->n], "+=", "gd");
+                break;
+            }
+            case OP_SOFTMAX_CE: {
+                const Reg *z = &p->args[in->a];
+                fprintf(f, "        const mg_real *q = buf + %u;\n", in->buf + in->n);
+                if (contiguous(z, in->n)) {
+                    fprintf(f, "        for (size_t i = 0; i < %u; ++i) g[%u + i] += q[i] * gd;\n", in->n, z[0]);
+                } else {
+                    for (size_t i = 0; i < in->n; ++i) {
+                        snprintf(e, sizeof(e), "q[%zu] * gd", i);
+                        emit_grad(f, p, z[i], "+=", e);
+                    }
+                }
+                break;
+            }
+            case OP_DENSE:
+            case OP_CHECKPOINT:
+                emit_run_backward(f, p, in);
+                break;
+            default:
+                break;
+        }
+        fprintf(f, "    }\n");
+    }
+    fprintf(f, "}\n");
+}
+
+static int emit_program(const Program *p, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+
+    fprintf(f, "/* Generated by microgradc program_jit(): %zu registers, %zu instructions */\n", p->n_regs, p->n_code);
+    fprintf(f, "#include <stddef.h>\n#include <tgmath.h>\n\n");
+    fprintf(f, "typedef %s mg_real;\n\n", MG_REAL_IS_FLOAT ? "float" : "double");
+    emit_forward(f, p);
+    emit_backward(f, p);
+
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/*
+ * Run cc directly, without a shell, on src. The flags are split on
+ * whitespace, no quoting, and -fPIC -shared is always added.
+ */
+static int compile(const char *cc, const char *cflags, const char *lib, const char *src) {
+    char *flags = strdup(cflags);
+    const char **argv = malloc(sizeof(char*) * (strlen(cflags) / 2 + 8));
+    if (!flags || !argv) {
+        free(flags);
+        free(argv);
+        return -1;
+    }
+
+    size_t n = 0;
+    char *save = NULL;
+    argv[n++] = cc;
+    for (char *t = strtok_r(flags, " \t\n", &save); t; t = strtok_r(NULL, " \t\n", &save)) {
+        argv[n++] = t;
+    }
+    argv[n++] = "-fPIC";
+    argv[n++] = "-shared";
+    argv[n++] = "-o";
+    argv[n++] = lib;
+    argv[n++] = src;
+    argv[n++] = "-lm";
+    argv[n] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execvp(cc, (char *const *)argv);
+        _exit(127);
+    }
+    free(flags);
+    free(argv);
+    if (pid < 0) return -1;
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int program_jit(Program *p) {
+    trace_begin("program_jit");
+    program_jit_free(p);
+
+    const char *tmp = getenv("TMPDIR");
+    const char *cc = getenv("MICROGRADC_CC");
+    const char *cflags = getenv("MICROGRADC_JIT_CFLAGS");
+    if (!tmp || !*tmp) tmp = "/tmp";
+    if (!cc || !*cc) cc = JIT_CC_DEFAULT;
+    if (!cflags) cflags = JIT_CFLAGS_DEFAULT;
+
+    char dir[512], src[600], lib[600];
+    snprintf(dir, sizeof(dir), "%s/microgradc-jit-XXXXXX", tmp);
+    if (!mkdtemp(dir)) {
+        perror("program_jit");
+        trace_end();
+        return -1;
+    }
+    snprintf(src, sizeof(src), "%s/program.c", dir);
+    snprintf(lib, sizeof(lib), "%s/program.so", dir);
+
+    void *handle = NULL;
+    if (emit_program(p, src) == 0) {
+        if (compile(cc, cflags, lib, src) == 0) {
+            handle = dlopen(lib, RTLD_NOW | RTLD_LOCAL);
+        }
+    }
+
+    // The mapping outlives the files
+    unlink(src);
+    unlink(lib);
+    rmdir(dir);
+
+    Program_Jit *jit = NULL;
+    if (handle) {
+        jit = calloc(1, sizeof(Program_Jit));
+        if (jit) {
+            jit->handle = handle;
+            jit->forward = (Program_Forward_Fn*)dlsym(handle, "mg_program_forward");
+            jit->backward = (Program_Backward_Fn*)dlsym(handle, "mg_program_backward");
+            jit->w = malloc(sizeof(mg_real*) * 4 * (p->n_layers ? p->n_layers : 1));
+        }
+        if (!jit || !jit->forward || !jit->backward || !jit->w) {
+            if (jit) free(jit->w);
+            free(jit);
+            jit = NULL;
+            dlclose(handle);
+        }
+    }
+
+    trace_end();
+    if (!jit) {
+        fprintf(stderr, "program_jit: could not build native code with `%s`, using the interpreter\n", cc);
+        return -1;
+    }
+    p->jit = jit;
+    return 0;
+}
+
+void program_jit_free(Program *p) {
+    if (!p->jit) return;
+    dlclose(p->jit->handle);
+    free(p->jit->w);
+    free(p->jit);
+    p->jit = NULL;
+}
@@ -0,0 +1,672 @@
+#include "kernels.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define KERNELS_X86 0
+#endif
+
+/* Activations without a vector form fall back to libm, element by element */
+static void act_forward_tail(Act_Kind act, mg_real *z, size_t n) {
+    switch (act) {
+        case ACT_TANH:
+            for (size_t i = 0; i < n; ++i) z[i] = tanh(z[i]);
+            break;
+        case ACT_SIGMOID:
+            for (size_t i = 0; i < n; ++i) z[i] = 1 / (1 + exp(-z[i]));
+            break;
+        case ACT_RELU:
+            for (size_t i = 0; i < n; ++i) z[i] = z[i] < 0 ? 0 : z[i];
+            break;
+        case ACT_LINEAR:
+        default:
+            break;
+    }
+}
+
+static void act_backward_tail(Act_Kind act, const mg_real *y, mg_real *dy, size_t n) {
+    switch (act) {
+        case ACT_TANH:
+            for (size_t i = 0; i < n; ++i) dy[i] *= 1 - y[i] * y[i];
+            break;
+        case ACT_SIGMOID:
+            for (size_t i = 0; i < n; ++i) dy[i] *= y[i] * (1 - y[i]);
+            break;
+        case ACT_RELU:
+            for (size_t i = 0; i < n; ++i) dy[i] = y[i] > 0 ? dy[i] : 0;
+            break;
+        case ACT_LINEAR:
+        default:
+            break;
+    }
+}
+
+/* Scalar */
+
+static mg_real dot_scalar(const mg_real *x, const mg_real *y, size_t n) {
+    mg_real s = 0;
+    for (size_t i = 0; i < n; ++i) s += x[i] * y[i];
+    return s;
+}
+
+static void axpy_scalar(mg_real a, const mg_real *x, mg_real *y, size_t n) {
+    for (size_t i = 0; i < n; ++i) y[i] += a * x[i];
+}
+
+static void scale_scalar(mg_real a, mg_real *x, size_t n) {
+    for (size_t i = 0; i < n; ++i) x[i] *= a;
+}
+
+static void momentum_scalar(mg_real mu, mg_real lr, mg_real wd, const mg_real *g, mg_real *v, mg_real *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        v[i] = mu * v[i] + (g[i] + wd * p[i]);
+        p[i] -= lr * v[i];
+    }
+}
+
+static void adam_scalar(mg_real b1, mg_real b2, mg_real lr, mg_real eps, mg_real wd,
+                        const mg_real *g, mg_real *m, mg_real *v, mg_real *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        mg_real gi = g[i] + wd * p[i];
+        m[i] = b1 * m[i] + (1 - b1) * gi;
+        v[i] = b2 * v[i] + (1 - b2) * gi * gi;
+        p[i] -= lr * (m[i] / (sqrt(v[i]) + eps));
+    }
+}
+
+static const Kernels kernels_scalar = {
+    .name = "scalar",
+    .dot = dot_scalar,
+    .axpy = axpy_scalar,
+    .scale = scale_scalar,
+    .act_forward = act_forward_tail,
+    .act_backward = act_backward_tail,
+    .momentum = momentum_scalar,
+    .adam = adam_scalar,
+};
+
+#if KERNELS_X86
+
+/*
+ * Intrinsics for the configured mg_real, so each kernel below is written
+ * once per instruction set and works for both precisions.
+ */
+#if MG_REAL_IS_FLOAT
+#define V128         __m128
+#define V128_ZERO    _mm_setzero_ps
+#define V128_SET1    _mm_set1_ps
+#define V128_LOAD    _mm_loadu_ps
+#define V128_STORE   _mm_storeu_ps
+#define V128_ADD     _mm_add_ps
+#define V128_SUB     _mm_sub_ps
+#define V128_MUL     _mm_mul_ps
+#define V128_DIV     _mm_div_ps
+#define V128_SQRT    _mm_sqrt_ps
+#define V128_MAX     _mm_max_ps
+#define V128_GT      _mm_cmpgt_ps
+#define V128_AND     _mm_and_ps
+
+#define V256         __m256
+#define V256_ZERO    _mm256_setzero_ps
+#define V256_SET1    _mm256_set1_ps
+#define V256_LOAD    _mm256_loadu_ps
+#define V256_STORE   _mm256_storeu_ps
+#define V256_ADD     _mm256_add_ps
+#define V256_SUB     _mm256_sub_ps
+#define V256_MUL     _mm256_mul_ps
+#define V256_DIV     _mm256_div_ps
+#define V256_SQRT    _mm256_sqrt_ps
+#define V256_FMA     _mm256_fmadd_ps
+#define V256_MAX     _mm256_max_ps
+#define V256_GT(a, b) _mm256_cmp_ps((a), (b), _CMP_GT_OQ)
+#define V256_AND     _mm256_and_ps
+
+#define V512         __m512
+#define V512_MASK    __mmask16
+#define V512_ZERO    _mm512_setzero_ps
+#define V512_SET1    _mm512_set1_ps
+#define V512_LOAD    _mm512_loadu_ps
+#define V512_STORE   _mm512_storeu_ps
+#define V512_LOADZ   _mm512_maskz_loadu_ps
+#define V512_STOREM  _mm512_mask_storeu_ps
+#define V512_ADD     _mm512_add_ps
+#define V512_SUB     _mm512_sub_ps
+#define V512_MUL     _mm512_mul_ps
+#define V512_DIV     _mm512_div_ps
+#define V512_SQRT    _mm512_sqrt_ps
+#define V512_FMA     _mm512_fmadd_ps
+#define V512_MAX     _mm512_max_ps
+#define V512_GT(a, b) _mm512_cmp_ps_mask((a), (b), _CMP_GT_OQ)
+#define V512_MOVZ    _mm512_maskz_mov_ps
+#define V512_REDUCE  _mm512_reduce_add_ps
+#else
+#define V128         __m128d
+#define V128_ZERO    _mm_setzero_pd
+#define V128_SET1    _mm_set1_pd
+#define V128_LOAD    _mm_loadu_pd
+#define V128_STORE   _mm_storeu_pd
+#define V128_ADD     _mm_add_pd
+#define V128_SUB     _mm_sub_pd
+#define V128_MUL     _mm_mul_pd
+#define V128_DIV     _mm_div_pd
+#define V128_SQRT    _mm_sqrt_pd
+#define V128_MAX     _mm_max_pd
+#define V128_GT      _mm_cmpgt_pd
+#define V128_AND     _mm_and_pd
+
+#define V256         __m256d
+#define V256_ZERO    _mm256_setzero_pd
+#define V256_SET1    _mm256_set1_pd
+#define V256_LOAD    _mm256_loadu_pd
+#define V256_STORE   _mm256_storeu_pd
+#define V256_ADD     _mm256_add_pd
+#define V256_SUB     _mm256_sub_pd
+#define V256_MUL     _mm256_mul_pd
+#define V256_DIV     _mm256_div_pd
+#define V256_SQRT    _mm256_sqrt_pd
+#define V256_FMA     _mm256_fmadd_pd
+#define V256_MAX     _mm256_max_pd
+#define V256_GT(a, b) _mm256_cmp_pd((a), (b), _CMP_GT_OQ)
+#define V256_AND     _mm256_and_pd
+
+#define V512         __m512d
+#define V512_MASK    __mmask8
+#define V512_ZERO    _mm512_setzero_pd
+#define V512_SET1    _mm512_set1_pd
+#define V512_LOAD    _mm512_loadu_pd
+#define V512_STORE   _mm512_storeu_pd
+#define V512_LOADZ   _mm512_maskz_loadu_pd
+#define V512_STOREM  _mm512_mask_storeu_pd
+#define V512_ADD     _mm512_add_pd
+#define V512_SUB     _mm512_sub_pd
+#define V512_MUL     _mm512_mul_pd
+#define V512_DIV     _mm512_div_pd
+#define V512_SQRT    _mm512_sqrt_pd
+#define V512_FMA     _mm512_fmadd_pd
+#define V512_MAX     _mm512_max_pd
+#define V512_GT(a, b) _mm512_cmp_pd_mask((a), (b), _CMP_GT_OQ)
+#define V512_MOVZ    _mm512_maskz_mov_pd
+#define V512_REDUCE  _mm512_reduce_add_pd
+#endif
+
+/* Lanes per register */
+#define W128 (16 / (size_t)sizeof(mg_real))
+#define W256 (32 / (size_t)sizeof(mg_real))
+#define W512 (64 / (size_t)sizeof(mg_real))
+
+__attribute__((target("sse2")))
+static inline mg_real hsum128(V128 v) {
+#if MG_REAL_IS_FLOAT
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+#else
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+#endif
+}
+
+__attribute__((target("avx2")))
+static inline mg_real hsum256(V256 v) {
+#if MG_REAL_IS_FLOAT
+    return hsum128(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+#else
+    return hsum128(_mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1)));
+#endif
+}
+
+/* SSE2 */
+
+__attribute__((target("sse2")))
+static mg_real dot_sse2(const mg_real *x, const mg_real *y, size_t n) {
+    V128 s0 = V128_ZERO(), s1 = V128_ZERO();
+    size_t i = 0;
+    for (; i + 2 * W128 <= n; i += 2 * W128) {
+        s0 = V128_ADD(s0, V128_MUL(V128_LOAD(x + i), V128_LOAD(y + i)));
+        s1 = V128_ADD(s1, V128_MUL(V128_LOAD(x + i + W128), V128_LOAD(y + i + W128)));
+    }
+    mg_real r = hsum128(V128_ADD(s0, s1));
+    for (; i < n; ++i) r += x[i] * y[i];
+    return r;
+}
+
+__attribute__((target("sse2")))
+static void axpy_sse2(mg_real a, const mg_real *x, mg_real *y, size_t n) {
+    V128 va = V128_SET1(a);
+    size_t i = 0;
+    for (; i + W128 <= n; i += W128) {
+        V128_STORE(y + i, V128_ADD(V128_LOAD(y + i), V128_MUL(va, V128_LOAD(x + i))));
+    }
+    for (; i < n; ++i) y[i] += a * x[i];
+}
+
+__attribute__((target("sse2")))
+static void scale_sse2(mg_real a, mg_real *x, size_t n) {
+    V128 va = V128_SET1(a);
+    size_t i = 0;
+    for (; i + W128 <= n; i += W128) {
+        V128_STORE(x + i, V128_MUL(va, V128_LOAD(x + i)));
+    }
+    for (; i < n; ++i) x[i] *= a;
+}
+
+__attribute__((target("sse2")))
+static void act_forward_sse2(Act_Kind act, mg_real *z, size_t n) {
+    if (act != ACT_RELU) {
+        act_forward_tail(act, z, n);
+        return;
+    }
+
+    /* max(0, z) keeps -0.0 and NaN exactly like z < 0 ? 0 : z */
+    V128 zero = V128_ZERO();
+    size_t i = 0;
+    for (; i + W128 <= n; i += W128) {
+        V128_STORE(z + i, V128_MAX(zero, V128_LOAD(z + i)));
+    }
+    act_forward_tail(act, z + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void act_backward_sse2(Act_Kind act, const mg_real *y, mg_real *dy, size_t n) {
+    V128 one = V128_SET1(1);
+    V128 zero = V128_ZERO();
+    size_t i = 0;
+
+    switch (act) {
+        case ACT_TANH:
+            for (; i + W128 <= n; i += W128) {
+                V128 vy = V128_LOAD(y + i);
+                V128 g = V128_SUB(one, V128_MUL(vy, vy));
+                V128_STORE(dy + i, V128_MUL(V128_LOAD(dy + i), g));
+            }
+            break;
+        case ACT_SIGMOID:
+            for (; i + W128 <= n; i += W128) {
+                V128 vy = V128_LOAD(y + i);
+                V128 g = V128_MUL(vy, V128_SUB(one, vy));
+                V128_STORE(dy + i, V128_MUL(V128_LOAD(dy + i), g));
+            }
+            break;
+        case ACT_RELU:
+            for (; i + W128 <= n; i += W128) {
+                V128 mask = V128_GT(V128_LOAD(y + i), zero);
+                V128_STORE(dy + i, V128_AND(mask, V128_LOAD(dy + i)));
+            }
+            break;
+        case ACT_LINEAR:
+        default:
+            return;
+    }
+    act_backward_tail(act, y + i, dy + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void momentum_sse2(mg_real mu, mg_real lr, mg_real wd, const mg_real *g, mg_real *v, mg_real *p, size_t n) {
+    V128 vmu = V128_SET1(mu), vlr = V128_SET1(lr), vwd = V128_SET1(wd);
+    size_t i = 0;
+    for (; i + W128 <= n; i += W128) {
+        V128 vg = V128_ADD(V128_LOAD(g + i), V128_MUL(vwd, V128_LOAD(p + i)));
+        V128 vv = V128_ADD(V128_MUL(vmu, V128_LOAD(v + i)), vg);
+        V128_STORE(v + i, vv);
+        V128_STORE(p + i, V128_SUB(V128_LOAD(p + i), V128_MUL(vlr, vv)));
+    }
+    momentum_scalar(mu, lr, wd, g + i, v + i, p + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void adam_sse2(mg_real b1, mg_real b2, mg_real lr, mg_real eps, mg_real wd,
+                      const mg_real *g, mg_real *m, mg_real *v, mg_real *p, size_t n) {
+    V128 vb1 = V128_SET1(b1), vc1 = V128_SET1(1 - b1);
+    V128 vb2 = V128_SET1(b2), vc2 = V128_SET1(1 - b2);
+    V128 vlr = V128_SET1(lr), veps = V128_SET1(eps), vwd = V128_SET1(wd);
+    size_t i = 0;
+    for (; i + W128 <= n; i += W128) {
+        V128 vg = V128_ADD(V128_LOAD(g + i), V128_MUL(vwd, V128_LOAD(p + i)));
+        V128 vm = V128_ADD(V128_MUL(vb1, V128_LOAD(m + i)), V128_MUL(vc1, vg));
+        V128 vv = V128_ADD(V128_MUL(vb2, V128_LOAD(v + i)), V128_MUL(V128_MUL(vc2, vg), vg));
+        V128 step = V128_DIV(vm, V128_ADD(V128_SQRT(vv), veps));
+        V128_STORE(m + i, vm);
+        V128_STORE(v + i, vv);
+        V128_STORE(p + i, V128_SUB(V128_LOAD(p + i), V128_MUL(vlr, step)));
+    }
+    adam_scalar(b1, b2, lr, eps, wd, g + i, m + i, v + i, p + i, n - i);
+}
+
+static const Kernels kernels_sse2 = {
+    .name = "sse2",
+    .dot = dot_sse2,
+    .axpy = axpy_sse2,
+    .scale = scale_sse2,
+    .act_forward = act_forward_sse2,
+    .act_backward = act_backward_sse2,
+    .momentum = momentum_sse2,
+    .adam = adam_sse2,
+};
+
+/* AVX2 + FMA */
+
+__attribute__((target("avx2,fma")))
+static mg_real dot_avx2(const mg_real *x, const mg_real *y, size_t n) {
+    V256 s0 = V256_ZERO(), s1 = V256_ZERO();
+    size_t i = 0;
+    for (; i + 2 * W256 <= n; i += 2 * W256) {
+        s0 = V256_FMA(V256_LOAD(x + i), V256_LOAD(y + i), s0);
+        s1 = V256_FMA(V256_LOAD(x + i + W256), V256_LOAD(y + i + W256), s1);
+    }
+    for (; i + W256 <= n; i += W256) {
+        s0 = V256_FMA(V256_LOAD(x + i), V256_LOAD(y + i), s0);
+    }
+    mg_real r = hsum256(V256_ADD(s0, s1));
+    for (; i < n; ++i) r = fma(x[i], y[i], r);
+    return r;
+}
+
+/* The tail uses fma() too so every element is rounded the same way */
+__attribute__((target("avx2,fma")))
+static void axpy_avx2(mg_real a, const mg_real *x, mg_real *y, size_t n) {
+    V256 va = V256_SET1(a);
+    size_t i = 0;
+    for (; i + W256 <= n; i += W256) {
+        V256_STORE(y + i, V256_FMA(va, V256_LOAD(x + i), V256_LOAD(y + i)));
+    }
+    for (; i < n; ++i) y[i] = fma(a, x[i], y[i]);
+}
+
+__attribute__((target("avx2,fma")))
+static void scale_avx2(mg_real a, mg_real *x, size_t n) {
+    V256 va = V256_SET1(a);
+    size_t i = 0;
+    for (; i + W256 <= n; i += W256) {
+        V256_STORE(x + i, V256_MUL(va, V256_LOAD(x + i)));
+    }
+    for (; i < n; ++i) x[i] *= a;
+}
+
+__attribute__((target("avx2,fma")))
+static void act_forward_avx2(Act_Kind act, mg_real *z, size_t n) {
+    if (act != ACT_RELU) {
+        act_forward_tail(act, z, n);
+        return;
+    }
+
+    V256 zero = V256_ZERO();
+    size_t i = 0;
+    for (; i + W256 <= n; i += W256) {
+        V256_STORE(z + i, V256_MAX(zero, V256_LOAD(z + i)));
+    }
+    act_forward_tail(act, z + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void act_backward_avx2(Act_Kind act, const mg_real *y, mg_real *dy, size_t n) {
+    V256 one = V256_SET1(1);
+    V256 zero = V256_ZERO();
+    size_t i = 0;
+
+    switch (act) {
+        case ACT_TANH:
+            for (; i + W256 <= n; i += W256) {
+                V256 vy = V256_LOAD(y + i);
+                V256 g = V256_SUB(one, V256_MUL(vy, vy));
+                V256_STORE(dy + i, V256_MUL(V256_LOAD(dy + i), g));
+            }
+            break;
+        case ACT_SIGMOID:
+            for (; i + W256 <= n; i += W256) {
+                V256 vy = V256_LOAD(y + i);
+                V256 g = V256_MUL(vy, V256_SUB(one, vy));
+                V256_STORE(dy + i, V256_MUL(V256_LOAD(dy + i), g));
+            }
+            break;
+        case ACT_RELU:
+            for (; i + W256 <= n; i += W256) {
+                V256 mask = V256_GT(V256_LOAD(y + i), zero);
+                V256_STORE(dy + i, V256_AND(mask, V256_LOAD(dy + i)));
+            }
+            break;
+        case ACT_LINEAR:
+        default:
+            return;
+    }
+    act_backward_tail(act, y + i, dy + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void momentum_avx2(mg_real mu, mg_real lr, mg_real wd, const mg_real *g, mg_real *v, mg_real *p, size_t n) {
+    V256 vmu = V256_SET1(mu), vnlr = V256_SET1(-lr), vwd = V256_SET1(wd);
+    size_t i = 0;
+    for (; i + W256 <= n; i += W256) {
+        V256 vp = V256_LOAD(p + i);
+        V256 vv = V256_FMA(vmu, V256_LOAD(v + i), V256_FMA(vwd, vp, V256_LOAD(g + i)));
+        V256_STORE(v + i, vv);
+        V256_STORE(p + i, V256_FMA(vnlr, vv, vp));
+    }
+    for (; i < n; ++i) {
+        v[i] = fma(mu, v[i], fma(wd, p[i], g[i]));
+        p[i] = fma(-lr, v[i], p[i]);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void adam_avx2(mg_real b1, mg_real b2, mg_real lr, mg_real eps, mg_real wd,
+                      const mg_real *g, mg_real *m, mg_real *v, mg_real *p, size_t n) {
+    V256 vb1 = V256_SET1(b1), vc1 = V256_SET1(1 - b1);
+    V256 vb2 = V256_SET1(b2), vc2 = V256_SET1(1 - b2);
+    V256 vnlr = V256_SET1(-lr), veps = V256_SET1(eps), vwd = V256_SET1(wd);
+    size_t i = 0;
+    for (; i + W256 <= n; i += W256) {
+        V256 vp = V256_LOAD(p + i);
+        V256 vg = V256_FMA(vwd, vp, V256_LOAD(g + i));
+        V256 vm = V256_FMA(vb1, V256_LOAD(m + i), V256_MUL(vc1, vg));
+        V256 vv = V256_FMA(vb2, V256_LOAD(v + i), V256_MUL(V256_MUL(vc2, vg), vg));
+        V256 step = V256_DIV(vm, V256_ADD(V256_SQRT(vv), veps));
+        V256_STORE(m + i, vm);
+        V256_STORE(v + i, vv);
+        V256_STORE(p + i, V256_FMA(vnlr, step, vp));
+    }
+    for (; i < n; ++i) {
+        mg_real gi = fma(wd, p[i], g[i]);
+        m[i] = fma(b1, m[i], (1 - b1) * gi);
+        v[i] = fma(b2, v[i], (1 - b2) * gi * gi);
+        p[i] = fma(-lr, m[i] / (sqrt(v[i]) + eps), p[i]);
+    }
+}
+
+static const Kernels kernels_avx2 = {
+    .name = "avx2",
+    .dot = dot_avx2,
+    .axpy = axpy_avx2,
+    .scale = scale_avx2,
+    .act_forward = act_forward_avx2,
+    .act_backward = act_backward_avx2,
+    .momentum = momentum_avx2,
+    .adam = adam_avx2,
+};
+
+/* AVX-512F, tails are handled with lane masks */
+
+#define V512_TAIL(r) ((V512_MASK)((1u << (r)) - 1))
+
+__attribute__((target("avx512f")))
+static mg_real dot_avx512(const mg_real *x, const mg_real *y, size_t n) {
+    V512 s0 = V512_ZERO(), s1 = V512_ZERO();
+    size_t i = 0;
+    for (; i + 2 * W512 <= n; i += 2 * W512) {
+        s0 = V512_FMA(V512_LOAD(x + i), V512_LOAD(y + i), s0);
+        s1 = V512_FMA(V512_LOAD(x + i + W512), V512_LOAD(y + i + W512), s1);
+    }
+    if (i + W512 <= n) {
+        s0 = V512_FMA(V512_LOAD(x + i), V512_LOAD(y + i), s0);
+        i += W512;
+    }
+    if (i < n) {
+        V512_MASK m = V512_TAIL(n - i);
+        s1 = V512_FMA(V512_LOADZ(m, x + i), V512_LOADZ(m, y + i), s1);
+    }
+    return V512_REDUCE(V512_ADD(s0, s1));
+}
+
+__attribute__((target("avx512f")))
+static void axpy_avx512(mg_real a, const mg_real *x, mg_real *y, size_t n) {
+    V512 va = V512_SET1(a);
+    size_t i = 0;
+    for (; i + W512 <= n; i += W512) {
+        V512_STORE(y + i, V512_FMA(va, V512_LOAD(x + i), V512_LOAD(y + i)));
+    }
+    if (i < n) {
+        V512_MASK m = V512_TAIL(n - i);
+        V512_STOREM(y + i, m, V512_FMA(va, V512_LOADZ(m, x + i), V512_LOADZ(m, y + i)));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void scale_avx512(mg_real a, mg_real *x, size_t n) {
+    V512 va = V512_SET1(a);
+    size_t i = 0;
+    for (; i + W512 <= n; i += W512) {
+        V512_STORE(x + i, V512_MUL(va, V512_LOAD(x + i)));
+    }
+    if (i < n) {
+        V512_MASK m = V512_TAIL(n - i);
+        V512_STOREM(x + i, m, V512_MUL(va, V512_LOADZ(m, x + i)));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void act_forward_avx512(Act_Kind act, mg_real *z, size_t n) {
+    if (act != ACT_RELU) {
+        act_forward_tail(act, z, n);
+        return;
+    }
+
+    V512 zero = V512_ZERO();
+    size_t i = 0;
+    for (; i + W512 <= n; i += W512) {
+        V512_STORE(z + i, V512_MAX(zero, V512_LOAD(z + i)));
+    }
+    act_forward_tail(act, z + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void act_backward_avx512(Act_Kind act, const mg_real *y, mg_real *dy, size_t n) {
+    V512 one = V512_SET1(1);
+    V512 zero = V512_ZERO();
+    size_t i = 0;
+
+    switch (act) {
+        case ACT_TANH:
+            for (; i + W512 <= n; i += W512) {
+                V512 vy = V512_LOAD(y + i);
+                V512 g = V512_SUB(one, V512_MUL(vy, vy));
+                V512_STORE(dy + i, V512_MUL(V512_LOAD(dy + i), g));
+            }
+            break;
+        case ACT_SIGMOID:
+            for (; i + W512 <= n; i += W512) {
+                V512 vy = V512_LOAD(y + i);
+                V512 g = V512_MUL(vy, V512_SUB(one, vy));
+                V512_STORE(dy + i, V512_MUL(V512_LOAD(dy + i), g));
+            }
+            break;
+        case ACT_RELU:
+            for (; i + W512 <= n; i += W512) {
+                V512_MASK m = V512_GT(V512_LOAD(y + i), zero);
+                V512_STORE(dy + i, V512_MOVZ(m, V512_LOAD(dy + i)));
+            }
+            break;
+        case ACT_LINEAR:
+        default:
+            return;
+    }
+    act_backward_tail(act, y + i, dy + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void momentum_avx512(mg_real mu, mg_real lr, mg_real wd, const mg_real *g, mg_real *v, mg_real *p, size_t n) {
+    V512 vmu = V512_SET1(mu), vnlr = V512_SET1(-lr), vwd = V512_SET1(wd);
+    size_t i = 0;
+    for (; i + W512 <= n; i += W512) {
+        V512 vp = V512_LOAD(p + i);
+        V512 vv = V512_FMA(vmu, V512_LOAD(v + i), V512_FMA(vwd, vp, V512_LOAD(g + i)));
+        V512_STORE(v + i, vv);
+        V512_STORE(p + i, V512_FMA(vnlr, vv, vp));
+    }
+    if (i < n) {
+        V512_MASK k = V512_TAIL(n - i);
+        V512 vp = V512_LOADZ(k, p + i);
+        V512 vv = V512_FMA(vmu, V512_LOADZ(k, v + i), V512_FMA(vwd, vp, V512_LOADZ(k, g + i)));
+        V512_STOREM(v + i, k, vv);
+        V512_STOREM(p + i, k, V512_FMA(vnlr, vv, vp));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void adam_avx512(mg_real b1, mg_real b2, mg_real lr, mg_real eps, mg_real wd,
+                        const mg_real *g, mg_real *m, mg_real *v, mg_real *p, size_t n) {
+    V512 vb1 = V512_SET1(b1), vc1 = V512_SET1(1 - b1);
+    V512 vb2 = V512_SET1(b2), vc2 = V512_SET1(1 - b2);
+    V512 vnlr = V512_SET1(-lr), veps = V512_SET1(eps), vwd = V512_SET1(wd);
+    size_t i = 0;
+    for (; i < n; i += W512) {
+        /* Lanes past the end compute on zeros and are never stored */
+        V512_MASK k = n - i >= W512 ? (V512_MASK)~0u : V512_TAIL(n - i);
+        V512 vp = V512_LOADZ(k, p + i);
+        V512 vg = V512_FMA(vwd, vp, V512_LOADZ(k, g + i));
+        V512 vm = V512_FMA(vb1, V512_LOADZ(k, m + i), V512_MUL(vc1, vg));
+        V512 vv = V512_FMA(vb2, V512_LOADZ(k, v + i), V512_MUL(V512_MUL(vc2, vg), vg));
+        V512 step = V512_DIV(vm, V512_ADD(V512_SQRT(vv), veps));
+        V512_STOREM(m + i, k, vm);
+        V512_STOREM(v + i, k, vv);
+        V512_STOREM(p + i, k, V512_FMA(vnlr, step, vp));
+    }
+}
+
+static const Kernels kernels_avx512 = {
+    .name = "avx512",
+    .dot = dot_avx512,
+    .axpy = axpy_avx512,
+    .scale = scale_avx512,
+    .act_forward = act_forward_avx512,
+    .act_backward = act_backward_avx512,
+    .momentum = momentum_avx512,
+    .adam = adam_avx512,
+};
+
+#endif // KERNELS_X86
+
+static const Kernels *kernels_active = &kernels_scalar;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void kernels_init(void) {
+    const Kernels *candidates[4];
+    size_t n = 0;
+
+#if KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) candidates[n++] = &kernels_avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) candidates[n++] = &kernels_avx2;
+    if (__builtin_cpu_supports("sse2")) candidates[n++] = &kernels_sse2;
+#endif
+    candidates[n++] = &kernels_scalar;
+
+    kernels_active = candidates[0];
+
+    const char *forced = getenv("MICROGRADC_KERNELS");
+    if (forced) {
+        for (size_t i = 0; i < n; ++i) {
+            if (strcmp(candidates[i]->name, forced) == 0) {
+                kernels_active = candidates[i];
+            }
+        }
+    }
+}
+
+const Kernels *kernels(void) {
+    pthread_once(&kernels_once, kernels_init);
+    return kernels_active;
+}
@@ -1,9 +1,20 @@
+#define _DEFAULT_SOURCE
 #include "nn.h"
+#include "kernels.h"
+#include "profile.h"
+#include "trace.h"
 #include "value.h"
 
-#include <math.h>
+#include <tgmath.h>
 #include <time.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 static double rand_from(double min, double max) {
     double u = (double)rand() / (double)RAND_MAX;
     return min + u * (max - min);
@@ -42,39 +53,63 @@ void neuron_zero_grad(Neuron *n) {
 }
 
 /* Layer */
-Layer *layer_alloc(Arena *a, Layer_Config *cfg) {
+
+/* Point the layer at the [w b] spans starting at p (parameters) and g (gradients) */
+static Layer *layer_bind(Arena *a, Layer_Config *cfg, mg_real *p, mg_real *g) {
     Layer *layer = arena_alloc(a, sizeof(Layer));
     layer->n_in = cfg->n_in;
     layer->n_out = cfg->n_out;
     layer->act = cfg->act;
-    
-    layer->neurons = arena_alloc(a, sizeof(Neuron*) * cfg->n_out);
-    for (size_t i = 0; i < cfg->n_out; ++i) {
-        layer->neurons[i] = neuron_alloc(a, cfg->n_in, cfg->act);
+
+    size_t n_w = cfg->n_in * cfg->n_out;
+    layer->w = p;
+    layer->b = p + n_w;
+    layer->dw = g;
+    layer->db = g + n_w;
+    return layer;
+}
+
+static void layer_init(Layer *l) {
+    /* Same draw order as a row of neurons: weights first, then bias */
+    for (size_t j = 0; j < l->n_out; ++j) {
+        for (size_t i = 0; i < l->n_in; ++i) {
+            l->w[j * l->n_in + i] = rand_from(-1, 1);
+        }
+        l->b[j] = rand_from(-1, 1);
     }
-    
+}
+
+Layer *layer_alloc(Arena *a, Layer_Config *cfg) {
+    size_t n = cfg->n_in * cfg->n_out + cfg->n_out;
+    mg_real *p = arena_alloc(a, sizeof(mg_real) * n);
+    mg_real *g = arena_alloc(a, sizeof(mg_real) * n);
+
+    Layer *layer = layer_bind(a, cfg, p, g);
+    layer_zero_grad(layer);
+    layer_init(layer);
     return layer;
 }
 
 void layer_print(Layer *l) {
     printf("Layer(in=%zu out=%zu)\n", l->n_in, l->n_out);
 
-    for (size_t i = 0; i < l->n_out; ++i) {
-        printf("\t");
-        neuron_print(l->neurons[i]);
-        printf("\n");
+    for (size_t j = 0; j < l->n_out; ++j) {
+        printf("\t\tNeuron(n_in=%zu act=%d) ", l->n_in, (int)l->act);
+        for (size_t i = 0; i < l->n_in; ++i) {
+            printf("w[%zu]=%.4f ", i, l->w[j * l->n_in + i]);
+        }
+        printf("b=%.4f\n", l->b[j]);
     }
 }
 
 void layer_zero_grad(Layer *l) {
-    for (size_t i = 0; i < l->n_out; ++i) {
-        neuron_zero_grad(l->neurons[i]);
-    }
+    memset(l->dw, 0, sizeof(mg_real) * l->n_in * l->n_out);
+    memset(l->db, 0, sizeof(mg_real) * l->n_out);
 }
 
 
 /* Forward */
-static Value *neuron_forward(Arena *a, Neuron *n, Value **x, size_t x_size) {
+Value *neuron_forward(Arena *a, Neuron *n, Value **x, size_t x_size) {
     if (n->n_in != x_size) {
         fprintf(stderr, "neuron_forward: invalid dimension (expect %zu got %zu)\n", n->n_in, x_size);
         exit(1);
@@ -83,21 +118,12 @@ static Value *neuron_forward(Arena *a, Neuron *n, Value **x, size_t x_size) {
     /* Visualize purposes */
     for (size_t i = 0; i < x_size; ++i) {
         x[i]->value_kind = VALUE_INPUT;
+        n->ws[i]->value_kind = VALUE_PARAM;
     }
-
-    Value *out = value_alloc(a, 0.0);
-    out->value_kind = VALUE_BOOTSTRAP;
-
-    for (size_t i = 0; i < x_size; ++i) {
-        Value *w = n->ws[i];
-        w->value_kind = VALUE_PARAM;
-        Value *mul = value_mul(a, w, x[i]);
-        out = value_add(a, out, mul);
-    }
-
-    /* Add bias */
     n->b->value_kind = VALUE_PARAM;
-    out = value_add(a, out, n->b);
+
+    /* One fused node for sum(wi * xi) + b */
+    Value *out = value_dot_bias(a, n->ws, x, x_size, n->b);
 
     /* Activation */
     switch (n->act) {
@@ -113,32 +139,179 @@ static Value *neuron_forward(Arena *a, Neuron *n, Value **x, size_t x_size) {
 
 
 /* Layer forward */
+
+/* Payload of an OP_DENSE node, inputs are the node's prev[] */
+typedef struct {
+    Layer *layer;
+    Value **out;    /* n_out OP_OUTPUT nodes */
+    mg_real *x;      /* inputs gathered into a contiguous vector */
+    mg_real *dx;     /* input gradients before they are scattered back */
+    mg_real *y;      /* outputs as a contiguous vector */
+    mg_real *dz;     /* output gradients through the activation */
+} Dense_Ctx;
+
+/**
+ * z = W x + b, y = act(z)
+ */
+static void forward_dense(Value *v) {
+    const Kernels *k = kernels();
+    Dense_Ctx *ctx = v->ctx;
+    Layer *l = ctx->layer;
+    mg_real *x = ctx->x;
+    mg_real *y = ctx->y;
+
+    for (size_t i = 0; i < l->n_in; ++i) {
+        x[i] = v->prev[i]->data;
+    }
+
+    for (size_t j = 0; j < l->n_out; ++j) {
+        y[j] = k->dot(&l->w[j * l->n_in], x, l->n_in) + l->b[j];
+    }
+    k->act_forward(l->act, y, l->n_out);
+
+    for (size_t j = 0; j < l->n_out; ++j) {
+        ctx->out[j]->data = y[j];
+    }
+}
+
+/**
+ * dz = dy * act'(y)
+ * dW += dz x^T, db += dz, dx += W^T dz
+ */
+static void backward_dense(Value *v) {
+    const Kernels *k = kernels();
+    Dense_Ctx *ctx = v->ctx;
+    Layer *l = ctx->layer;
+    const mg_real *x = ctx->x;
+    mg_real *dx = ctx->dx;
+    mg_real *dz = ctx->dz;
+
+    for (size_t j = 0; j < l->n_out; ++j) {
+        dz[j] = ctx->out[j]->grad;
+    }
+    k->act_backward(l->act, ctx->y, dz, l->n_out);
+
+    memset(dx, 0, sizeof(mg_real) * l->n_in);
+
+    for (size_t j = 0; j < l->n_out; ++j) {
+        if (dz[j] == 0.0) continue;
+        k->axpy(dz[j], x, &l->dw[j * l->n_in], l->n_in);
+        k->axpy(dz[j], &l->w[j * l->n_in], dx, l->n_in);
+        l->db[j] += dz[j];
+    }
+
+    for (size_t i = 0; i < l->n_in; ++i) {
+        v->prev[i]->grad += dx[i];
+    }
+}
+
 Value **layer_forward(Arena *a, Layer *l, Value **x, size_t x_size) {
     if (l->n_in != x_size) {
         fprintf(stderr, "layer_forward: invalid dimension (expect %zu got %zu)\n", l->n_in, x_size);
         exit(1);
     }
 
-    Value **out = arena_alloc(a, sizeof(Value*) * l->n_out);
-    for (size_t i = 0; i < l->n_out; ++i) {
-        out[i] = neuron_forward(a, l->neurons[i], x, x_size);
+    Dense_Ctx *ctx = arena_alloc(a, sizeof(Dense_Ctx));
+    ctx->layer = l;
+    ctx->out = arena_alloc(a, sizeof(Value*) * l->n_out);
+    ctx->x = arena_alloc(a, sizeof(mg_real) * l->n_in);
+    ctx->dx = arena_alloc(a, sizeof(mg_real) * l->n_in);
+    ctx->y = arena_alloc(a, sizeof(mg_real) * l->n_out);
+    ctx->dz = arena_alloc(a, sizeof(mg_real) * l->n_out);
+
+    Value *node = value_alloc(a, 0.0);
+    node->op = OP_DENSE;
+    MG_PROFILE_NODE(OP_DENSE);
+    node->ctx = ctx;
+    node->n_prev = x_size;
+    node->prev = arena_memdup(a, x, sizeof(Value*) * x_size);
+    node->forward = forward_dense;
+    node->backward = backward_dense;
+
+    for (size_t j = 0; j < l->n_out; ++j) {
+        Value *out = value_alloc(a, 0.0);
+        out->op = OP_OUTPUT;
+        MG_PROFILE_NODE(OP_OUTPUT);
+        out->n_prev = 1;
+        out->prev = arena_alloc(a, sizeof(Value*));
+        out->prev[0] = node;
+        ctx->out[j] = out;
     }
-    return out;
+
+    forward_dense(node);
+    return ctx->out;
 }
 
 // MLP
 
-MLP *mlp_alloc(Arena *a, Layer_Config *layer_configs, size_t config_size) {
+/* Size the prediction buffers once the layers are known */
+static void mlp_alloc_act(Arena *a, MLP *m) {
+    size_t width = 1;
+    for (size_t i = 0; i < m->layer_size; ++i) {
+        if (m->layers[i]->n_out > width) width = m->layers[i]->n_out;
+    }
+    m->act[0] = arena_alloc(a, sizeof(mg_real) * width);
+    m->act[1] = arena_alloc(a, sizeof(mg_real) * width);
+}
+
+static size_t layer_param_count(const Layer_Config *cfg) {
+    return cfg->n_in * cfg->n_out + cfg->n_out;
+}
+
+/*
+ * Lay every layer out in one parameter block and one gradient block.
+ * params/grads may be supplied (a mapped file); otherwise they come from a,
+ * with the gradients zeroed. Parameters are left as they are.
+ */
+static MLP *mlp_alloc_layout(Arena *a, Layer_Config *cfgs, size_t layer_size, mg_real *params, mg_real *grads) {
     MLP *mlp = arena_alloc(a, sizeof(MLP));
-    mlp->layer_size = config_size;
-    mlp->layers = arena_alloc(a, sizeof(Layer*) * config_size);
+    mlp->map = NULL;
+    mlp->layer_size = layer_size;
+    mlp->layers = arena_alloc(a, sizeof(Layer*) * layer_size);
+    mlp->offsets = arena_alloc(a, sizeof(size_t) * (layer_size + 1));
+
+    size_t n = 0;
+    for (size_t i = 0; i < layer_size; ++i) {
+        mlp->offsets[i] = n;
+        n += layer_param_count(&cfgs[i]);
+    }
+    mlp->offsets[layer_size] = n;
+    mlp->n_params = n;
+
+    if (!params) params = arena_alloc(a, sizeof(mg_real) * (n ? n : 1));
+    if (!grads) {
+        grads = arena_alloc(a, sizeof(mg_real) * (n ? n : 1));
+        memset(grads, 0, sizeof(mg_real) * n);
+    }
+    mlp->params = params;
+    mlp->grads = grads;
+
+    for (size_t i = 0; i < layer_size; ++i) {
+        size_t off = mlp->offsets[i];
+        mlp->layers[i] = layer_bind(a, &cfgs[i], params + off, grads + off);
+    }
+    mlp_alloc_act(a, mlp);
+    return mlp;
+}
+
+MLP *mlp_alloc(Arena *a, Layer_Config *layer_configs, size_t config_size) {
+    MLP *mlp = mlp_alloc_layout(a, layer_configs, config_size, NULL, NULL);
 
     for (size_t i = 0; i < config_size; ++i) {
-        mlp->layers[i] = layer_alloc(a, &layer_configs[i]);
+        layer_init(mlp->layers[i]);
     }
     return mlp;
 }
 
+Params mlp_parameters(MLP *m) {
+    return (Params){
+        .data = m->params,
+        .grad = m->grads,
+        .size = m->n_params,
+        .offsets = m->offsets,
+    };
+}
+
 void mlp_print(MLP *m) {
     printf("MLP (layers=%zu)\n", m->layer_size);
     for (size_t i = 0; i < m->layer_size; ++i) {
@@ -147,6 +320,20 @@ void mlp_print(MLP *m) {
     }
 }
 
+/* Mirrors the allocations of layer_forward */
+static size_t layer_forward_bytes(const Layer *l) {
+    return arena_alloc_size(sizeof(Dense_Ctx)) +
+           arena_alloc_size(sizeof(Value*) * l->n_out) +
+           2 * arena_alloc_size(sizeof(mg_real) * l->n_in) +
+           2 * arena_alloc_size(sizeof(mg_real) * l->n_out) +
+           value_bytes(1) + arena_alloc_size(sizeof(Value*) * l->n_in) +
+           l->n_out * (value_bytes(1) + arena_alloc_size(sizeof(Value*)));
+}
+
+Graph_Plan mlp_plan(const MLP *m, Loss_Kind loss, size_t step_leaves) {
+    return mlp_plan_checkpoint(m, loss, step_leaves, 0);
+}
+
 /* Build the DAG: pass the vector through every layer */
 Value **mlp_forward(Arena *a, MLP *m, Value **x, size_t x_size) {
     if (m->layer_size == 0) return x;
@@ -156,6 +343,8 @@ Value **mlp_forward(Arena *a, MLP *m, Value **x, size_t x_size) {
         exit(1);
     }
 
+    trace_begin("mlp_forward");
+
     Value **out = x;
     size_t current_size = x_size;
 
@@ -163,85 +352,636 @@ Value **mlp_forward(Arena *a, MLP *m, Value **x, size_t x_size) {
         out = layer_forward(a, m->layers[i], out, current_size);
         current_size = m->layers[i]->n_out;
     }
+
+    trace_end();
     return out;
 }
 
-/* zero grads */
-void mlp_zero_grad(MLP *m) {
+/* Mini-batch */
+
+/**
+ * Y = act(X W^T + b)
+ * X is B x n_in, Y is B x n_out
+ */
+void layer_forward_batch(Layer *l, const mg_real *x, mg_real *y, size_t batch_size) {
+    const Kernels *k = kernels();
+
+    for (size_t s = 0; s < batch_size; ++s) {
+        const mg_real *xs = &x[s * l->n_in];
+        mg_real *ys = &y[s * l->n_out];
+
+        for (size_t j = 0; j < l->n_out; ++j) {
+            ys[j] = k->dot(&l->w[j * l->n_in], xs, l->n_in) + l->b[j];
+        }
+    }
+    k->act_forward(l->act, y, batch_size * l->n_out);
+}
+
+/**
+ * dZ = dY * act'(Y), rewritten in place over dy
+ * dW += dZ^T X, db += sum of dZ rows, dX = dZ W
+ * dx may be NULL for the first layer
+ */
+void layer_backward_batch(Layer *l, const mg_real *x, const mg_real *y, mg_real *dy, mg_real *dx, size_t batch_size) {
+    const Kernels *k = kernels();
+
+    k->act_backward(l->act, y, dy, batch_size * l->n_out);
+
+    for (size_t s = 0; s < batch_size; ++s) {
+        const mg_real *xs = &x[s * l->n_in];
+        const mg_real *dz = &dy[s * l->n_out];
+
+        for (size_t j = 0; j < l->n_out; ++j) {
+            if (dz[j] == 0.0) continue;
+            k->axpy(dz[j], xs, &l->dw[j * l->n_in], l->n_in);
+            l->db[j] += dz[j];
+        }
+    }
+
+    if (!dx) return;
+
+    memset(dx, 0, sizeof(mg_real) * batch_size * l->n_in);
+    for (size_t s = 0; s < batch_size; ++s) {
+        const mg_real *dz = &dy[s * l->n_out];
+        mg_real *dxs = &dx[s * l->n_in];
+
+        for (size_t j = 0; j < l->n_out; ++j) {
+            if (dz[j] == 0.0) continue;
+            k->axpy(dz[j], &l->w[j * l->n_in], dxs, l->n_in);
+        }
+    }
+}
+
+/* Run a B x n_in matrix through every layer, the output is bt->y[layer_size - 1] */
+Batch *mlp_forward_batch(Arena *a, MLP *m, const mg_real *x, size_t batch_size) {
+    trace_begin("mlp_forward_batch");
+
+    Batch *bt = arena_alloc(a, sizeof(Batch));
+    bt->size = batch_size;
+    bt->x = x;
+    bt->y = arena_alloc(a, sizeof(mg_real*) * m->layer_size);
+
+    const mg_real *in = x;
     for (size_t i = 0; i < m->layer_size; ++i) {
-        layer_zero_grad(m->layers[i]);
+        Layer *l = m->layers[i];
+        bt->y[i] = arena_alloc(a, sizeof(mg_real) * batch_size * l->n_out);
+        layer_forward_batch(l, in, bt->y[i], batch_size);
+        in = bt->y[i];
     }
+
+    trace_end();
+    return bt;
 }
 
-static void neuron_update(Neuron *n, double lr) {
-    for (size_t i = 0; i < n->n_in; ++i) {
-        n->ws[i]->data -= lr * n->ws[i]->grad;
+/**
+ * dy is the B x n_out gradient of each sample's loss w.r.t. the output.
+ * Parameter gradients receive the mean over the batch, so one mlp_update()
+ * per batch takes a step on the average loss.
+ */
+void mlp_backward_batch(Arena *a, MLP *m, Batch *bt, const mg_real *dy) {
+    if (m->layer_size == 0 || bt->size == 0) return;
+
+    trace_begin("mlp_backward_batch");
+    Arena_Mark mark = arena_snapshot(a);
+
+    size_t last = m->layer_size - 1;
+    size_t n = bt->size * m->layers[last]->n_out;
+    mg_real *g = arena_memdup(a, (void*)dy, sizeof(mg_real) * n);
+    kernels()->scale(1.0 / (mg_real)bt->size, g, n);
+
+    for (size_t i = m->layer_size; i-- > 0;) {
+        Layer *l = m->layers[i];
+        const mg_real *x = i == 0 ? bt->x : bt->y[i - 1];
+        mg_real *dx = i == 0 ? NULL : arena_alloc(a, sizeof(mg_real) * bt->size * l->n_in);
+
+        layer_backward_batch(l, x, bt->y[i], g, dx, bt->size);
+        g = dx;
     }
-    n->b->data -= lr * n->b->grad;
+
+    arena_rewind(a, mark);
+    trace_end();
 }
 
-static void layer_update(Layer *l, double lr) {
-    for (size_t i = 0; i < l->n_out; ++i) {
-        neuron_update(l->neurons[i], lr);
+/*
+ * Gradient checkpointing
+ *
+ * A segment is a run of consecutive layers that enters the graph as one
+ * OP_CHECKPOINT node. The node keeps the segment's input and output only;
+ * the activations in between go to a scratch buffer shared by every segment
+ * of the forward and are recomputed from the input when backward reaches
+ * the segment.
+ */
+typedef struct {
+    mg_real *act;   /* interior outputs of one segment, back to back */
+    mg_real *g[2];  /* gradient ping-pong, widest layer */
+} Checkpoint_Scratch;
+
+/* Payload of an OP_CHECKPOINT node, inputs are the node's prev[] */
+typedef struct {
+    Layer **layers;
+    size_t n_layers;
+    Value **out;    /* OP_OUTPUT nodes of the last layer */
+    mg_real *x;      /* segment input, gathered */
+    mg_real *y;      /* output of the last layer */
+    Checkpoint_Scratch *scratch;
+} Checkpoint_Ctx;
+
+/* Scratch lengths for segments of every layers: interior outputs and widest layer */
+static void checkpoint_sizes(const MLP *m, size_t every, size_t *act, size_t *width) {
+    *act = 0;
+    *width = 0;
+    for (size_t start = 0; start < m->layer_size; start += every) {
+        size_t end = start + every < m->layer_size ? start + every : m->layer_size;
+        size_t interior = 0;
+        for (size_t i = start; i < end; ++i) {
+            const Layer *l = m->layers[i];
+            if (i + 1 < end) interior += l->n_out;
+            if (l->n_in > *width) *width = l->n_in;
+            if (l->n_out > *width) *width = l->n_out;
+        }
+        if (interior > *act) *act = interior;
+    }
+}
+
+/* Run the segment from ctx->x, interior outputs into the scratch */
+static void checkpoint_run(Checkpoint_Ctx *ctx) {
+    const mg_real *in = ctx->x;
+    mg_real *act = ctx->scratch->act;
+
+    for (size_t i = 0; i < ctx->n_layers; ++i) {
+        Layer *l = ctx->layers[i];
+        mg_real *y = i + 1 == ctx->n_layers ? ctx->y : act;
+        layer_forward_batch(l, in, y, 1);
+        in = y;
+        act += l->n_out;
+    }
+}
+
+static void forward_checkpoint(Value *v) {
+    Checkpoint_Ctx *ctx = v->ctx;
+    size_t n_in = ctx->layers[0]->n_in;
+    size_t n_out = ctx->layers[ctx->n_layers - 1]->n_out;
+
+    for (size_t i = 0; i < n_in; ++i) {
+        ctx->x[i] = v->prev[i]->data;
+    }
+
+    checkpoint_run(ctx);
+
+    for (size_t j = 0; j < n_out; ++j) {
+        ctx->out[j]->data = ctx->y[j];
     }
 }
 
-void mlp_update(MLP *m, double lr) {
+/* Recompute the interior, then backward through the layers in reverse */
+static void backward_checkpoint(Value *v) {
+    Checkpoint_Ctx *ctx = v->ctx;
+    Checkpoint_Scratch *s = ctx->scratch;
+    size_t last = ctx->n_layers - 1;
+
+    // Later segments have overwritten the scratch since this one ran
+    if (ctx->n_layers > 1) checkpoint_run(ctx);
+
+    size_t off = 0;
+    for (size_t i = 0; i < last; ++i) off += ctx->layers[i]->n_out;
+
+    mg_real *g = s->g[0];
+    mg_real *dx = s->g[1];
+    for (size_t j = 0; j < ctx->layers[last]->n_out; ++j) {
+        g[j] = ctx->out[j]->grad;
+    }
+
+    for (size_t i = ctx->n_layers; i-- > 0;) {
+        Layer *l = ctx->layers[i];
+        const mg_real *y = i == last ? ctx->y : s->act + off;
+        if (i > 0) off -= ctx->layers[i - 1]->n_out;
+        const mg_real *x = i == 0 ? ctx->x : s->act + off;
+
+        layer_backward_batch(l, x, y, g, dx, 1);
+
+        mg_real *tmp = g;
+        g = dx;
+        dx = tmp;
+    }
+
+    for (size_t i = 0; i < ctx->layers[0]->n_in; ++i) {
+        v->prev[i]->grad += g[i];
+    }
+}
+
+static Value **checkpoint_forward(Arena *a, Layer **layers, size_t n_layers, Value **x, Checkpoint_Scratch *s) {
+    size_t n_in = layers[0]->n_in;
+    size_t n_out = layers[n_layers - 1]->n_out;
+
+    Checkpoint_Ctx *ctx = arena_alloc(a, sizeof(Checkpoint_Ctx));
+    ctx->layers = layers;
+    ctx->n_layers = n_layers;
+    ctx->scratch = s;
+    ctx->out = arena_alloc(a, sizeof(Value*) * n_out);
+    ctx->x = arena_alloc(a, sizeof(mg_real) * n_in);
+    ctx->y = arena_alloc(a, sizeof(mg_real) * n_out);
+
+    Value *node = value_alloc(a, 0.0);
+    node->op = OP_CHECKPOINT;
+    MG_PROFILE_NODE(OP_CHECKPOINT);
+    node->ctx = ctx;
+    node->n_prev = n_in;
+    node->prev = arena_memdup(a, x, sizeof(Value*) * n_in);
+    node->forward = forward_checkpoint;
+    node->backward = backward_checkpoint;
+
+    for (size_t j = 0; j < n_out; ++j) {
+        Value *out = value_alloc(a, 0.0);
+        out->op = OP_OUTPUT;
+        MG_PROFILE_NODE(OP_OUTPUT);
+        out->n_prev = 1;
+        out->prev = arena_alloc(a, sizeof(Value*));
+        out->prev[0] = node;
+        ctx->out[j] = out;
+    }
+
+    forward_checkpoint(node);
+    return ctx->out;
+}
+
+Value **mlp_forward_checkpoint(Arena *a, MLP *m, Value **x, size_t x_size, size_t every) {
+    if (every == 0) return mlp_forward(a, m, x, x_size);
+    if (m->layer_size == 0) return x;
+
+    if (m->layers[0]->n_in != x_size) {
+        fprintf(stderr, "mlp_forward_checkpoint: input size mismatch (expect %zu got %zu)\n", m->layers[0]->n_in, x_size);
+        exit(1);
+    }
+
+    trace_begin("mlp_forward");
+
+    size_t act, width;
+    checkpoint_sizes(m, every, &act, &width);
+
+    Checkpoint_Scratch *s = arena_alloc(a, sizeof(Checkpoint_Scratch));
+    s->act = arena_alloc(a, sizeof(mg_real) * (act ? act : 1));
+    s->g[0] = arena_alloc(a, sizeof(mg_real) * width);
+    s->g[1] = arena_alloc(a, sizeof(mg_real) * width);
+
+    Value **out = x;
+    for (size_t start = 0; start < m->layer_size; start += every) {
+        size_t n = start + every < m->layer_size ? every : m->layer_size - start;
+        out = checkpoint_forward(a, &m->layers[start], n, out, s);
+    }
+
+    trace_end();
+    return out;
+}
+
+size_t fused_layers(const Value *node, Layer ***layers, Value ***outputs) {
+    if (node->op == OP_DENSE) {
+        Dense_Ctx *ctx = node->ctx;
+        *layers = &ctx->layer;
+        *outputs = ctx->out;
+        return 1;
+    }
+    if (node->op == OP_CHECKPOINT) {
+        Checkpoint_Ctx *ctx = node->ctx;
+        *layers = ctx->layers;
+        *outputs = ctx->out;
+        return ctx->n_layers;
+    }
+    return 0;
+}
+
+/* Mirrors the allocations of mlp_forward_checkpoint and checkpoint_forward */
+static size_t checkpoint_forward_bytes(const MLP *m, size_t every, size_t *n_nodes, size_t *n_segments) {
+    size_t act, width;
+    checkpoint_sizes(m, every, &act, &width);
+
+    size_t bytes = arena_alloc_size(sizeof(Checkpoint_Scratch)) +
+                   arena_alloc_size(sizeof(mg_real) * (act ? act : 1)) +
+                   2 * arena_alloc_size(sizeof(mg_real) * width);
+
+    *n_nodes = 0;
+    *n_segments = 0;
+    for (size_t start = 0; start < m->layer_size; start += every) {
+        size_t end = start + every < m->layer_size ? start + every : m->layer_size;
+        size_t n_in = m->layers[start]->n_in;
+        size_t n_out = m->layers[end - 1]->n_out;
+
+        bytes += arena_alloc_size(sizeof(Checkpoint_Ctx)) +
+                 arena_alloc_size(sizeof(Value*) * n_out) +
+                 arena_alloc_size(sizeof(mg_real) * n_in) +
+                 arena_alloc_size(sizeof(mg_real) * n_out) +
+                 value_bytes(1) + arena_alloc_size(sizeof(Value*) * n_in) +
+                 n_out * (value_bytes(1) + arena_alloc_size(sizeof(Value*)));
+        *n_nodes += 1 + n_out;
+        *n_segments += 1;
+    }
+    return bytes;
+}
+
+Graph_Plan mlp_plan_checkpoint(const MLP *m, Loss_Kind loss, size_t step_leaves, size_t every) {
+    Graph_Plan plan = {0};
+    if (m->layer_size == 0) return plan;
+
+    size_t n_in = m->layers[0]->n_in;
+    size_t n_out = m->layers[m->layer_size - 1]->n_out;
+
+    plan.n_nodes = n_in;
+    plan.forward_bytes = value_bytes(step_leaves);
+
+    /* Inputs, then one fused node and its outputs per layer or segment */
+    size_t n_fused = m->layer_size;
+    if (every == 0) {
+        for (size_t i = 0; i < m->layer_size; ++i) {
+            plan.n_nodes += 1 + m->layers[i]->n_out;
+            plan.forward_bytes += layer_forward_bytes(m->layers[i]);
+        }
+    } else {
+        size_t n_nodes;
+        plan.forward_bytes += checkpoint_forward_bytes(m, every, &n_nodes, &n_fused);
+        plan.n_nodes += n_nodes;
+    }
+
+    /*
+     * Deepest DFS path from the loss: through the first output of every
+     * fused node down to an input, two nodes per layer or segment
+     */
+    size_t chain = 2 * n_fused + 1;
+    size_t depth = 0;
+
+    switch (loss) {
+        case LOSS_NONE:
+            break;
+        case LOSS_MSE:
+            /* n, div, the targets and sub + square per output, joined by n_out - 1 adds */
+            plan.n_nodes += 1 + n_out + 3 * n_out;
+            plan.forward_bytes += mse_bytes(n_out);
+            depth = n_out + 2 + chain;  /* div and the add chain, square, sub */
+            break;
+        case LOSS_SOFTMAX_CE:
+            plan.n_nodes += 2;              /* loss and target */
+            plan.forward_bytes += softmax_cross_entropy_bytes(n_out);
+            depth = 1 + chain;
+            break;
+    }
+
+    if (loss != LOSS_NONE) {
+        plan.backward_bytes = value_backward_bytes(plan.n_nodes, depth);
+    }
+    plan.total_bytes = plan.forward_bytes + plan.backward_bytes;
+    return plan;
+}
+
+
+/* Inference */
+
+size_t mlp_predict(MLP *m, const mg_real *x, mg_real *out) {
+    if (m->layer_size == 0) return 0;
+
+    const mg_real *in = x;
     for (size_t i = 0; i < m->layer_size; ++i) {
-        layer_update(m->layers[i], lr);
+        mg_real *y = m->act[i % 2];
+        layer_forward_batch(m->layers[i], in, y, 1);
+        in = y;
+    }
+
+    size_t n_out = m->layers[m->layer_size - 1]->n_out;
+    size_t best = 0;
+    for (size_t j = 1; j < n_out; ++j) {
+        if (in[j] > in[best]) best = j;
+    }
+
+    if (out) {
+        memcpy(out, in, sizeof(mg_real) * n_out);
     }
+    return best;
+}
+
+void mlp_predict_batch(MLP *m, const mg_real *x, size_t batch_size, mg_real *out, size_t *classes) {
+    if (m->layer_size == 0) return;
+
+    size_t n_in = m->layers[0]->n_in;
+    size_t n_out = m->layers[m->layer_size - 1]->n_out;
+
+    trace_begin("mlp_predict_batch");
+    for (size_t s = 0; s < batch_size; ++s) {
+        size_t best = mlp_predict(m, &x[s * n_in], out ? &out[s * n_out] : NULL);
+        if (classes) classes[s] = best;
+    }
+    trace_end();
+}
+
+/* zero grads */
+void mlp_zero_grad(MLP *m) {
+    trace_begin("zero_grad");
+    memset(m->grads, 0, sizeof(mg_real) * m->n_params);
+    trace_end();
+}
+
+void mlp_update(MLP *m, mg_real lr) {
+    trace_begin("update");
+    kernels()->axpy(-lr, m->grads, m->params, m->n_params);
+    trace_end();
+}
+
+/*
+ * Model files
+ *
+ * v2 layout: a 64-byte header, one Model_Layer entry per layer, then the
+ * parameters as one packed [w0 b0 w1 b1 ...] block (the order of
+ * mlp_parameters) starting on a NN_FILE_ALIGN boundary. The table records
+ * where each weight matrix and bias vector sits, so readers don't depend on
+ * the packing; a packed block can be used in place once mapped.
+ *
+ * v1 (a 16-byte header) and headerless files store metadata and reals
+ * interleaved; they are still read by mlp_load().
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t real_size;
+    uint32_t layer_size;
+    uint64_t file_size;
+    uint8_t reserved[40];
+} Model_Header;
+
+typedef struct {
+    uint32_t n_in;
+    uint32_t n_out;
+    uint32_t act;
+    uint32_t reserved;
+    uint64_t w_offset;
+    uint64_t b_offset;
+} Model_Layer;
+
+_Static_assert(sizeof(Model_Header) == 64, "Model_Header must be 64 bytes");
+_Static_assert(sizeof(Model_Layer) == 32, "Model_Layer must be 32 bytes");
+
+static uint64_t align_up(uint64_t n) {
+    return (n + NN_FILE_ALIGN - 1) & ~(uint64_t)(NN_FILE_ALIGN - 1);
+}
+
+static uint64_t model_params_offset(size_t layer_size) {
+    return align_up(sizeof(Model_Header) + sizeof(Model_Layer) * layer_size);
+}
+
+/* True when the blocks follow each other as [w0 b0 w1 b1 ...] from the aligned start */
+static bool model_packed(const Model_Layer *table, size_t layer_size, uint32_t real_size) {
+    uint64_t offset = model_params_offset(layer_size);
+    for (size_t i = 0; i < layer_size; ++i) {
+        if (table[i].w_offset != offset) return false;
+        offset += (uint64_t)real_size * table[i].n_in * table[i].n_out;
+        if (table[i].b_offset != offset) return false;
+        offset += (uint64_t)real_size * table[i].n_out;
+    }
+    return true;
+}
+
+/*
+ * Every weight and bias block lies inside a file of size bytes and all of
+ * them together fit in it, so nothing sized from the table can outgrow the
+ * file. Products are of u32 shapes and cannot wrap in 64 bits.
+ */
+static bool model_table_fits(const Model_Layer *table, size_t layer_size, uint32_t real_size, uint64_t size) {
+    uint64_t reals = size / real_size;
+    uint64_t total = 0;
+    for (size_t i = 0; i < layer_size; ++i) {
+        uint64_t n_w = (uint64_t)table[i].n_in * table[i].n_out;
+        uint64_t n_b = table[i].n_out;
+        if (n_w > reals || n_b > reals - n_w || total > reals - n_w - n_b) return false;
+        total += n_w + n_b;
+
+        if (table[i].w_offset > size || n_w * real_size > size - table[i].w_offset) return false;
+        if (table[i].b_offset > size || n_b * real_size > size - table[i].b_offset) return false;
+    }
+    return true;
+}
+
+/* Size of an open file, restoring its position. -1 on error */
+static long file_length(FILE *f) {
+    long pos = ftell(f);
+    if (pos < 0 || fseek(f, 0, SEEK_END) != 0) return -1;
+    long end = ftell(f);
+    if (fseek(f, pos, SEEK_SET) != 0) return -1;
+    return end;
+}
+
+/* Layer shapes read from a file must chain and name a known activation */
+static bool model_configs_valid(const Layer_Config *cfgs, size_t layer_size) {
+    for (size_t i = 0; i < layer_size; ++i) {
+        if (cfgs[i].n_in == 0 || cfgs[i].n_out == 0) {
+            fprintf(stderr, "mlp_load: layer %zu has an empty shape\n", i);
+            return false;
+        }
+        if ((uint32_t)cfgs[i].act > ACT_SIGMOID) {
+            fprintf(stderr, "mlp_load: layer %zu has unknown activation %u\n", i, (uint32_t)cfgs[i].act);
+            return false;
+        }
+        if (i > 0 && cfgs[i].n_in != cfgs[i - 1].n_out) {
+            fprintf(stderr, "mlp_load: layer %zu takes %zu inputs but layer %zu has %zu outputs\n",
+                    i, cfgs[i].n_in, i - 1, cfgs[i - 1].n_out);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Collect the layer shapes of a table, caller frees. NULL when they are invalid */
+static Layer_Config *model_configs(const Model_Layer *table, size_t layer_size) {
+    Layer_Config *cfgs = calloc(layer_size ? layer_size : 1, sizeof(Layer_Config));
+    if (!cfgs) return NULL;
+
+    for (size_t i = 0; i < layer_size; ++i) {
+        cfgs[i] = NN_LAYER_CFG(table[i].n_in, table[i].n_out, (Act_Kind)table[i].act);
+    }
+    if (!model_configs_valid(cfgs, layer_size)) {
+        free(cfgs);
+        return NULL;
+    }
+    return cfgs;
 }
 
-// In mlp_save - use fixed-size types
 int mlp_save(MLP *m, const char *filename) {
     FILE *f = fopen(filename, "wb");
     if (!f) return -1;
 
-    // Write layer_size as uint32_t (fixed 4 bytes)
-    uint32_t layer_size = (uint32_t)m->layer_size;
-    fwrite(&layer_size, sizeof(uint32_t), 1, f);
+    Model_Layer *table = calloc(m->layer_size ? m->layer_size : 1, sizeof(Model_Layer));
+    if (!table) {
+        fclose(f);
+        return -1;
+    }
 
-    for (size_t i = 0; i < m->layer_size; i++) {
+    uint64_t start = model_params_offset(m->layer_size);
+    for (size_t i = 0; i < m->layer_size; ++i) {
         Layer *l = m->layers[i];
-        
-        // Write as uint32_t
-        uint32_t n_in = (uint32_t)l->n_in;
-        uint32_t n_out = (uint32_t)l->n_out;
-        uint32_t act = (uint32_t)l->act;
-        
-        fwrite(&n_in, sizeof(uint32_t), 1, f);
-        fwrite(&n_out, sizeof(uint32_t), 1, f);
-        fwrite(&act, sizeof(uint32_t), 1, f);
-
-        for (size_t j = 0; j < l->n_out; j++) {
-            for (size_t k = 0; k < l->n_in; k++) {
-                double val = l->neurons[j]->ws[k]->data;
-                fwrite(&val, sizeof(double), 1, f);
-            }
-            double b = l->neurons[j]->b->data;
-            fwrite(&b, sizeof(double), 1, f);
-        }
+        table[i] = (Model_Layer){
+            .n_in = (uint32_t)l->n_in,
+            .n_out = (uint32_t)l->n_out,
+            .act = (uint32_t)l->act,
+        };
+        table[i].w_offset = start + sizeof(mg_real) * m->offsets[i];
+        table[i].b_offset = table[i].w_offset + sizeof(mg_real) * l->n_in * l->n_out;
     }
 
-    fclose(f);
-    return 0;
+    Model_Header header = {
+        .magic = NN_FILE_MAGIC,
+        .version = NN_FILE_VERSION,
+        .real_size = MG_REAL_SIZE,
+        .layer_size = (uint32_t)m->layer_size,
+    };
+    header.file_size = start + sizeof(mg_real) * m->n_params;
+
+    static const uint8_t zeros[NN_FILE_ALIGN] = {0};
+    size_t pad = (size_t)(start - sizeof(header) - sizeof(Model_Layer) * m->layer_size);
+
+    // Metadata, then every parameter in a single write
+    trace_begin("mlp_save");
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(table, sizeof(Model_Layer), m->layer_size, f) == m->layer_size &&
+             fwrite(zeros, 1, pad, f) == pad &&
+             fwrite(m->params, sizeof(mg_real), m->n_params, f) == m->n_params;
+
+    free(table);
+    if (fclose(f) != 0) ok = 0;
+    trace_end();
+    return ok ? 0 : -1;
 }
 
-MLP *mlp_load(Arena *a, const char *filename) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) return NULL;
+/* Reals are stored in the precision the file declares, converting on load */
+static int read_real(FILE *f, uint32_t real_size, mg_real *out) {
+    if (real_size == sizeof(float)) {
+        float v;
+        if (fread(&v, sizeof(float), 1, f) != 1) return -1;
+        *out = (mg_real)v;
+    } else {
+        double v;
+        if (fread(&v, sizeof(double), 1, f) != 1) return -1;
+        *out = (mg_real)v;
+    }
+    return 0;
+}
 
-    // Read layer_size
-    uint32_t layer_size_u32;
-    if (fread(&layer_size_u32, sizeof(uint32_t), 1, f) != 1) {
-        fclose(f);
-        return NULL;
+static int read_block(FILE *f, uint32_t real_size, mg_real *dst, size_t n) {
+    if (real_size == sizeof(mg_real)) {
+        return fread(dst, sizeof(mg_real), n, f) == n ? 0 : -1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (read_real(f, real_size, &dst[i]) != 0) return -1;
     }
-    size_t layer_size = (size_t)layer_size_u32;
+    return 0;
+}
 
-    MLP *m = arena_alloc(a, sizeof(MLP));
-    m->layer_size = layer_size;
-    m->layers = arena_alloc(a, sizeof(Layer*) * layer_size);
+/*
+ * v1 and headerless files: per layer metadata followed by its reals.
+ * A first pass collects the shapes so the parameters can be laid out in
+ * one block, a second one reads them.
+ */
+static MLP *mlp_load_interleaved(Arena *a, FILE *f, uint32_t real_size, size_t layer_size) {
+    long start = ftell(f);
+    long end = file_length(f);
+    // Every layer takes at least its three u32 of metadata
+    if (start < 0 || end < start || layer_size > (uint64_t)(end - start) / (3 * sizeof(uint32_t))) return NULL;
+
+    Layer_Config *cfgs = calloc(layer_size ? layer_size : 1, sizeof(Layer_Config));
+    if (!cfgs) return NULL;
 
     for (size_t i = 0; i < layer_size; i++) {
         // Read metadata
@@ -250,39 +990,223 @@ MLP *mlp_load(Arena *a, const char *filename) {
         if (fread(&n_in_u32, sizeof(uint32_t), 1, f) != 1 ||
             fread(&n_out_u32, sizeof(uint32_t), 1, f) != 1 ||
             fread(&act_u32, sizeof(uint32_t), 1, f) != 1) {
-            fclose(f);
+            free(cfgs);
             return NULL;
         }
-        
-        size_t n_in = (size_t)n_in_u32;
-        size_t n_out = (size_t)n_out_u32;
-        Act_Kind act = (Act_Kind)act_u32;
+        cfgs[i] = NN_LAYER_CFG(n_in_u32, n_out_u32, (Act_Kind)act_u32);
+
+        // Skip weights and biases, which must be in the file
+        long pos = ftell(f);
+        uint64_t n = (uint64_t)n_out_u32 * ((uint64_t)n_in_u32 + 1);
+        if (pos < 0 || n > (uint64_t)(end - pos) / real_size ||
+            fseek(f, (long)(n * real_size), SEEK_CUR) != 0) {
+            free(cfgs);
+            return NULL;
+        }
+    }
+
+    if (!model_configs_valid(cfgs, layer_size)) {
+        free(cfgs);
+        return NULL;
+    }
+
+    MLP *m = mlp_alloc_layout(a, cfgs, layer_size, NULL, NULL);
+    free(cfgs);
 
-        Layer_Config cfg = { .n_in = n_in, .n_out = n_out, .act = act };
-        Layer *l = layer_alloc(a, &cfg);
+    if (fseek(f, start, SEEK_SET) != 0) return NULL;
+
+    for (size_t i = 0; i < layer_size; i++) {
+        Layer *l = m->layers[i];
+        if (fseek(f, 3 * sizeof(uint32_t), SEEK_CUR) != 0) return NULL;
 
         // Read weights and biases
-        for (size_t j = 0; j < n_out; j++) {
-            for (size_t k = 0; k < n_in; k++) {
-                double val;
-                if (fread(&val, sizeof(double), 1, f) != 1) {
-                    fclose(f);
-                    return NULL;
-                }
-                l->neurons[j]->ws[k]->data = val;
-            }
-            
-            double b;
-            if (fread(&b, sizeof(double), 1, f) != 1) {
-                fclose(f);
+        for (size_t j = 0; j < l->n_out; j++) {
+            if (read_block(f, real_size, &l->w[j * l->n_in], l->n_in) != 0 ||
+                read_real(f, real_size, &l->b[j]) != 0) {
                 return NULL;
             }
-            l->neurons[j]->b->data = b;
         }
+    }
+    return m;
+}
+
+static MLP *mlp_load_v2(Arena *a, FILE *f, const Model_Header *header) {
+    size_t layer_size = header->layer_size;
+    long size = file_length(f);
+    if (size < 0 || model_params_offset(layer_size) > (uint64_t)size) return NULL;
+
+    Model_Layer *table = calloc(layer_size ? layer_size : 1, sizeof(Model_Layer));
+    if (!table) return NULL;
+
+    Layer_Config *cfgs = NULL;
+    if (fread(table, sizeof(Model_Layer), layer_size, f) != layer_size) {
+        free(table);
+        return NULL;
+    }
+    if (!model_table_fits(table, layer_size, header->real_size, (uint64_t)size)) {
+        fprintf(stderr, "mlp_load: layer shapes do not fit in the file\n");
+        free(table);
+        return NULL;
+    }
+    if (!(cfgs = model_configs(table, layer_size))) {
+        free(table);
+        return NULL;
+    }
+
+    MLP *m = mlp_alloc_layout(a, cfgs, layer_size, NULL, NULL);
+    free(cfgs);
+
+    int ok = 1;
+    if (model_packed(table, layer_size, header->real_size)) {
+        ok = fseek(f, (long)model_params_offset(layer_size), SEEK_SET) == 0 &&
+             read_block(f, header->real_size, m->params, m->n_params) == 0;
+    } else {
+        for (size_t i = 0; ok && i < layer_size; ++i) {
+            Layer *l = m->layers[i];
+            ok = fseek(f, (long)table[i].w_offset, SEEK_SET) == 0 &&
+                 read_block(f, header->real_size, l->w, l->n_in * l->n_out) == 0 &&
+                 fseek(f, (long)table[i].b_offset, SEEK_SET) == 0 &&
+                 read_block(f, header->real_size, l->b, l->n_out) == 0;
+        }
+    }
+
+    free(table);
+    return ok ? m : NULL;
+}
+
+MLP *mlp_load(Arena *a, const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return NULL;
+
+    // Header, or the layer_size of a headerless file of doubles
+    uint32_t first[4];
+    if (fread(first, sizeof(uint32_t), 1, f) != 1) {
+        fclose(f);
+        return NULL;
+    }
+
+    trace_begin("mlp_load");
+    MLP *m = NULL;
 
-        m->layers[i] = l;
+    if (first[0] != NN_FILE_MAGIC) {
+        m = mlp_load_interleaved(a, f, sizeof(double), first[0]);
+    } else if (fread(&first[1], sizeof(uint32_t), 3, f) != 3) {
+        m = NULL;
+    } else if (first[2] != sizeof(float) && first[2] != sizeof(double)) {
+        fprintf(stderr, "mlp_load: unsupported real size %u\n", first[2]);
+    } else if (first[1] == 1) {
+        m = mlp_load_interleaved(a, f, first[2], first[3]);
+    } else if (first[1] == 2) {
+        Model_Header header;
+        if (fseek(f, 0, SEEK_SET) == 0 && fread(&header, sizeof(header), 1, f) == 1) {
+            m = mlp_load_v2(a, f, &header);
+        }
+    } else {
+        fprintf(stderr, "mlp_load: unsupported file version %u\n", first[1]);
     }
 
     fclose(f);
+    trace_end();
+    return m;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+struct Model_Map {
+    void *file;
+    size_t file_size;
+    void *grads;
+    size_t grads_size;
+};
+
+/* Everything mlp_load_mmap needs to use the mapped parameters in place */
+static bool model_map_valid(const uint8_t *base, size_t size) {
+    if (size < sizeof(Model_Header)) return false;
+
+    const Model_Header *header = (const Model_Header*)base;
+    if (header->magic != NN_FILE_MAGIC || header->version != NN_FILE_VERSION ||
+        header->real_size != MG_REAL_SIZE || header->file_size > size) {
+        return false;
+    }
+
+    uint64_t start = model_params_offset(header->layer_size);
+    if (start > size) return false;
+
+    const Model_Layer *table = (const Model_Layer*)(base + sizeof(Model_Header));
+    return model_table_fits(table, header->layer_size, MG_REAL_SIZE, size) &&
+           model_packed(table, header->layer_size, MG_REAL_SIZE);
+}
+
+MLP *mlp_load_mmap(Arena *a, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    size_t file_size = (size_t)st.st_size;
+
+    /* Private: pages are shared through the page cache until written */
+    uint8_t *base = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    if (!model_map_valid(base, file_size)) {
+        /* Older format, other precision or unpacked: fall back to a converting copy */
+        munmap(base, file_size);
+        return mlp_load(a, filename);
+    }
+
+    const Model_Header *header = (const Model_Header*)base;
+    const Model_Layer *table = (const Model_Layer*)(base + sizeof(Model_Header));
+    Layer_Config *cfgs = model_configs(table, header->layer_size);
+    if (!cfgs) {
+        munmap(base, file_size);
+        return NULL;
+    }
+
+    size_t n_params = 0;
+    for (size_t i = 0; i < header->layer_size; ++i) {
+        n_params += layer_param_count(&cfgs[i]);
+    }
+
+    /* Gradients in an anonymous mapping, untouched pages cost nothing */
+    size_t grads_size = align_up(sizeof(mg_real) * n_params);
+    if (grads_size == 0) grads_size = NN_FILE_ALIGN;
+
+    void *grads = mmap(NULL, grads_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (grads == MAP_FAILED) {
+        free(cfgs);
+        munmap(base, file_size);
+        return NULL;
+    }
+
+    mg_real *params = (mg_real*)(base + model_params_offset(header->layer_size));
+    MLP *m = mlp_alloc_layout(a, cfgs, header->layer_size, params, grads);
+    free(cfgs);
+
+    m->map = arena_alloc(a, sizeof(Model_Map));
+    *m->map = (Model_Map){ .file = base, .file_size = file_size, .grads = grads, .grads_size = grads_size };
     return m;
-}
\ No newline at end of file
+}
+
+void mlp_unmap(MLP *m) {
+    if (!m->map) return;
+    munmap(m->map->file, m->map->file_size);
+    munmap(m->map->grads, m->map->grads_size);
+    m->map = NULL;
+}
+
+#else
+
+MLP *mlp_load_mmap(Arena *a, const char *filename) {
+    return mlp_load(a, filename);
+}
+
+void mlp_unmap(MLP *m) {
+    (void)m;
+}
+
+#endif
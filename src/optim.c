@@ -0,0 +1,87 @@
+#include "optim.h"
+#include "kernels.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <tgmath.h>
+
+Optimizer *optim_alloc(Arena *a, MLP *m, Optim_Config cfg) {
+    Optimizer *o = arena_alloc(a, sizeof(Optimizer));
+    o->cfg = cfg;
+    o->mlp = m;
+    o->n_params = m->n_params;
+    o->m = NULL;
+    o->v = NULL;
+
+    switch (cfg.kind) {
+        case OPTIM_SGD:
+            break;
+        case OPTIM_MOMENTUM:
+            o->m = arena_alloc(a, sizeof(mg_real) * o->n_params);
+            break;
+        case OPTIM_ADAM:
+        case OPTIM_ADAMW:
+            o->m = arena_alloc(a, sizeof(mg_real) * o->n_params);
+            o->v = arena_alloc(a, sizeof(mg_real) * o->n_params);
+            break;
+        default:
+            fprintf(stderr, "optim_alloc: unknown optimizer kind %d\n", (int)cfg.kind);
+            exit(1);
+    }
+
+    optim_reset(o);
+    return o;
+}
+
+void optim_reset(Optimizer *o) {
+    o->t = 0;
+    if (o->m) memset(o->m, 0, sizeof(mg_real) * o->n_params);
+    if (o->v) memset(o->v, 0, sizeof(mg_real) * o->n_params);
+}
+
+void optim_step(Optimizer *o) {
+    const Kernels *k = kernels();
+    const Optim_Config *c = &o->cfg;
+    mg_real lr = c->lr;
+    mg_real eps = c->eps;
+
+    o->t++;
+    if (c->kind == OPTIM_ADAM || c->kind == OPTIM_ADAMW) {
+        /* lr * sqrt(1 - b2^t) / (1 - b1^t), with eps rescaled to match */
+        mg_real bc1 = 1 - pow(c->beta1, (mg_real)o->t);
+        mg_real bc2 = sqrt(1 - pow(c->beta2, (mg_real)o->t));
+        lr = lr * bc2 / bc1;
+        eps = eps * bc2;
+    }
+
+    trace_begin("update");
+
+    // The whole model in one sweep
+    Params params = mlp_parameters(o->mlp);
+    mg_real *p = params.data;
+    mg_real *g = params.grad;
+    size_t n = params.size;
+
+    mg_real wd = c->weight_decay;
+
+    switch (c->kind) {
+        case OPTIM_SGD:
+            /* p -= lr * (g + wd * p) */
+            if (wd != 0) k->scale(1 - lr * wd, p, n);
+            k->axpy(-lr, g, p, n);
+            break;
+        case OPTIM_MOMENTUM:
+            k->momentum(c->momentum, lr, wd, g, o->m, p, n);
+            break;
+        case OPTIM_ADAM:
+            k->adam(c->beta1, c->beta2, lr, eps, wd, g, o->m, o->v, p, n);
+            break;
+        case OPTIM_ADAMW:
+            if (wd != 0) k->scale(1 - c->lr * wd, p, n);
+            k->adam(c->beta1, c->beta2, lr, eps, 0, g, o->m, o->v, p, n);
+            break;
+    }
+
+    trace_end();
+}
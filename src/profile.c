@@ -0,0 +1,147 @@
+#define _DEFAULT_SOURCE
+#include "profile.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_RDTSC 1
+#else
+#define PROFILE_RDTSC 0
+#endif
+
+/* One block per thread that ever counted, kept after the thread exits */
+typedef struct Profile_Block Profile_Block;
+struct Profile_Block {
+    Profile p;
+    Profile_Block *next;
+};
+
+static Profile_Block *profile_blocks = NULL;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local Profile_Block *profile_block = NULL;
+
+Profile *profile_local(void) {
+    if (profile_block) return &profile_block->p;
+
+    Profile_Block *b = calloc(1, sizeof(Profile_Block));
+    if (!b) {
+        fprintf(stderr, "profile_local: out of memory\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&profile_lock);
+    b->next = profile_blocks;
+    profile_blocks = b;
+    pthread_mutex_unlock(&profile_lock);
+
+    profile_block = b;
+    return &b->p;
+}
+
+uint64_t profile_ticks(void) {
+#if PROFILE_RDTSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+const char *profile_tick_unit(void) {
+    return PROFILE_RDTSC ? "cycles" : "ns";
+}
+
+size_t profile_arena_bytes(const Arena *a) {
+    size_t n = 0;
+    for (Region *r = a->begin; r != NULL; r = r->next) {
+        n += r->count * sizeof(uintptr_t);
+        if (r == a->end) break;
+    }
+    return n;
+}
+
+static uint64_t max_u64(uint64_t x, uint64_t y) {
+    return x > y ? x : y;
+}
+
+bool profile_collect(Profile *out) {
+    memset(out, 0, sizeof(*out));
+
+    pthread_mutex_lock(&profile_lock);
+    for (Profile_Block *b = profile_blocks; b != NULL; b = b->next) {
+        const Profile *p = &b->p;
+        for (size_t op = 0; op < MG_OP_COUNT; ++op) {
+            out->nodes[op] += p->nodes[op];
+            out->backward_calls[op] += p->backward_calls[op];
+            out->backward_sampled[op] += p->backward_sampled[op];
+            out->backward_ticks[op] += p->backward_ticks[op];
+        }
+        out->passes += p->passes;
+        out->sorted_nodes += p->sorted_nodes;
+        out->topo_ticks += p->topo_ticks;
+        out->propagate_ticks += p->propagate_ticks;
+        out->graph_bytes += p->graph_bytes;
+        out->graph_bytes_max = max_u64(out->graph_bytes_max, p->graph_bytes_max);
+        out->scratch_bytes += p->scratch_bytes;
+        out->scratch_bytes_max = max_u64(out->scratch_bytes_max, p->scratch_bytes_max);
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    return MG_PROFILE;
+}
+
+void profile_reset(void) {
+    pthread_mutex_lock(&profile_lock);
+    for (Profile_Block *b = profile_blocks; b != NULL; b = b->next) {
+        memset(&b->p, 0, sizeof(b->p));
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * (double)part / (double)total : 0.0;
+}
+
+void profile_print(FILE *f, const Profile *p) {
+    if (!MG_PROFILE) {
+        fprintf(f, "profile: not built in, rebuild with make PROFILE=1\n");
+        return;
+    }
+
+    const char *unit = profile_tick_unit();
+
+    // Sampled ticks scaled up to every call of the op
+    double est[MG_OP_COUNT];
+    double est_total = 0;
+    for (size_t op = 0; op < MG_OP_COUNT; ++op) {
+        est[op] = p->backward_sampled[op]
+            ? (double)p->backward_ticks[op] / (double)p->backward_sampled[op] * (double)p->backward_calls[op]
+            : 0;
+        est_total += est[op];
+    }
+
+    fprintf(f, "%-12s %14s %14s %14s %8s\n", "op", "nodes", "backward", unit, "share");
+    for (size_t op = 0; op < MG_OP_COUNT; ++op) {
+        if (p->nodes[op] == 0 && p->backward_calls[op] == 0) continue;
+        fprintf(f, "%-12s %14llu %14llu %14.0f %7.1f%%\n", op_to_string((Op_Kind)op),
+                (unsigned long long)p->nodes[op], (unsigned long long)p->backward_calls[op],
+                est[op], est_total > 0 ? 100.0 * est[op] / est_total : 0.0);
+    }
+
+    uint64_t backward = p->topo_ticks + p->propagate_ticks;
+    fprintf(f, "value_backward: %llu passes, %llu %s, topo sort %.1f%%, propagation %.1f%%\n",
+            (unsigned long long)p->passes, (unsigned long long)backward, unit,
+            percent(p->topo_ticks, backward), percent(p->propagate_ticks, backward));
+
+    if (p->passes > 0) {
+        fprintf(f, "per pass: %.1f nodes, %.0f graph bytes (max %llu), %.0f scratch bytes (max %llu)\n",
+                (double)p->sorted_nodes / (double)p->passes,
+                (double)p->graph_bytes / (double)p->passes, (unsigned long long)p->graph_bytes_max,
+                (double)p->scratch_bytes / (double)p->passes, (unsigned long long)p->scratch_bytes_max);
+    }
+}
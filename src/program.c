@@ -0,0 +1,974 @@
+#include "program.h"
+#include "trace.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#define REG_NONE UINT32_MAX
+
+/* Value* -> register, open addressing over a power of two table */
+typedef struct {
+    const Value **keys;
+    Reg *regs;
+    size_t mask;
+} Reg_Map;
+
+static size_t hash_u64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+static size_t hash_value(const Value *v) {
+    return hash_u64((uint64_t)(uintptr_t)v);
+}
+
+static void reg_map_init(Arena *a, Reg_Map *m, size_t n) {
+    size_t cap = 16;
+    while (cap < 2 * n) cap *= 2;
+    m->keys = arena_alloc(a, sizeof(Value*) * cap);
+    m->regs = arena_alloc(a, sizeof(Reg) * cap);
+    memset(m->keys, 0, sizeof(Value*) * cap);
+    m->mask = cap - 1;
+}
+
+static Reg reg_map_get(const Reg_Map *m, const Value *v) {
+    for (size_t i = hash_value(v) & m->mask;; i = (i + 1) & m->mask) {
+        if (m->keys[i] == v) return m->regs[i];
+        if (m->keys[i] == NULL) return REG_NONE;
+    }
+}
+
+static void reg_map_put(Reg_Map *m, const Value *v, Reg r) {
+    size_t i = hash_value(v) & m->mask;
+    while (m->keys[i] != NULL && m->keys[i] != v) i = (i + 1) & m->mask;
+    m->keys[i] = v;
+    m->regs[i] = r;
+}
+
+/* Growable arrays for the compile, in the scratch arena */
+typedef struct { Program_Instr *items; size_t count, capacity; } Instr_Da;
+typedef struct { Reg *items; size_t count, capacity; } Reg_Da;
+typedef struct { uint32_t *items; size_t count, capacity; } U32_Da;
+typedef struct { Layer **items; size_t count, capacity; } Layer_Da;
+typedef struct { Program_Run *items; size_t count, capacity; } Run_Da;
+
+static uint32_t layer_index(Arena *a, Layer_Da *layers, Layer *l) {
+    for (size_t i = 0; i < layers->count; ++i) {
+        if (layers->items[i] == l) return (uint32_t)i;
+    }
+    arena_da_append(a, layers, l);
+    return (uint32_t)(layers->count - 1);
+}
+
+static bool is_layer_run(uint8_t op) {
+    return op == OP_DENSE || op == OP_CHECKPOINT;
+}
+
+static size_t run_n_in(const Program *p, const Program_Instr *in) {
+    return p->layers[p->run_layers[p->runs[in->n].first]]->n_in;
+}
+
+static size_t run_n_out(const Program *p, const Program_Instr *in) {
+    const Program_Run *r = &p->runs[in->n];
+    return p->layers[p->run_layers[r->first + r->count - 1]]->n_out;
+}
+
+/* Reverse schedule and scratch sizes, from the code and the layer table */
+static void program_finish(Arena *a, Program *p) {
+    bool *needs = arena_alloc(a, sizeof(bool) * (p->n_regs ? p->n_regs : 1));
+    memset(needs, 0, sizeof(bool) * p->n_regs);
+    for (size_t i = 0; i < p->n_params; ++i) needs[p->n_inputs + i] = true;
+
+    // An instruction is differentiated if anything it reads depends on a param
+    bool *keep = arena_alloc(a, sizeof(bool) * (p->n_code ? p->n_code : 1));
+    p->n_reverse = 0;
+    p->buf_size = 0;
+    p->width = 1;
+
+    for (size_t k = 0; k < p->n_code; ++k) {
+        Program_Instr *in = &p->code[k];
+        bool any = false;
+        size_t n_dst = 1;
+
+        switch ((Op_Kind)in->op) {
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+                in->flags = (needs[in->a] ? PROGRAM_GRAD_A : 0) | (needs[in->b] ? PROGRAM_GRAD_B : 0);
+                any = in->flags != 0;
+                break;
+            case OP_DOT_BIAS:
+                for (size_t i = 0; i < 2 * (size_t)in->n + 1; ++i) any = any || needs[p->args[in->a + i]];
+                break;
+            case OP_SOFTMAX_CE:
+                for (size_t i = 0; i < in->n; ++i) any = any || needs[p->args[in->a + i]];
+                p->buf_size += 2 * (size_t)in->n;
+                break;
+            case OP_DENSE:
+            case OP_CHECKPOINT: {
+                size_t n_in = run_n_in(p, in);
+                bool grad_in = false;
+                for (size_t i = 0; i < n_in; ++i) grad_in = grad_in || needs[p->args[in->a + i]];
+                in->flags = grad_in ? PROGRAM_GRAD_IN : 0;
+                any = true;     /* the weights always are */
+
+                const Program_Run *r = &p->runs[in->n];
+                size_t size = n_in;
+                for (size_t i = 0; i < r->count; ++i) {
+                    const Layer *l = p->layers[p->run_layers[r->first + i]];
+                    size += l->n_out;
+                    if (l->n_in > p->width) p->width = l->n_in;
+                    if (l->n_out > p->width) p->width = l->n_out;
+                }
+                p->buf_size += size;
+                n_dst = run_n_out(p, in);
+                break;
+            }
+            default:
+                in->flags = needs[in->a] ? PROGRAM_GRAD_A : 0;
+                any = in->flags != 0;
+                break;
+        }
+
+        keep[k] = any;
+        for (size_t j = 0; j < n_dst; ++j) needs[in->dst + j] = any;
+        if (any) p->n_reverse++;
+    }
+
+    // Scratch offsets in code order
+    size_t off = 0;
+    for (size_t k = 0; k < p->n_code; ++k) {
+        Program_Instr *in = &p->code[k];
+        if (in->op == OP_SOFTMAX_CE) {
+            in->buf = (uint32_t)off;
+            off += 2 * (size_t)in->n;
+        } else if (is_layer_run(in->op)) {
+            in->buf = (uint32_t)off;
+            const Program_Run *r = &p->runs[in->n];
+            off += run_n_in(p, in);
+            for (size_t i = 0; i < r->count; ++i) off += p->layers[p->run_layers[r->first + i]]->n_out;
+        }
+    }
+
+    p->reverse = arena_alloc(a, sizeof(uint32_t) * (p->n_reverse ? p->n_reverse : 1));
+    size_t r = 0;
+    for (size_t k = p->n_code; k-- > 0;) {
+        if (keep[k]) p->reverse[r++] = (uint32_t)k;
+    }
+
+    p->buf = arena_alloc(a, sizeof(mg_real) * (p->buf_size ? p->buf_size : 1));
+    p->g[0] = arena_alloc(a, sizeof(mg_real) * p->width);
+    p->g[1] = arena_alloc(a, sizeof(mg_real) * p->width);
+}
+
+/*
+ * Simplification ahead of lowering, one sweep in topological order:
+ *
+ *   - constants: leaves that are neither inputs nor params, and any node
+ *     whose operands are all constant, folded to the data it was built
+ *     with. Equal constants share a register.
+ *   - identities: x + 0, 0 + x, x - 0, x * 1, 1 * x, x / 1 and x ^ 1 are x
+ *   - pow(x, 2) is lowered to OP_SQUARE
+ *   - the same op on the same operands is computed once
+ *
+ * Only nodes the root still depends on are then given registers, so the
+ * zero a sum starts from or a constant exponent costs nothing at run time.
+ */
+#define NODE_CONST 0x01
+#define NODE_LIVE  0x02
+
+typedef struct {
+    Value **topo;
+    size_t n_topo;
+    Reg_Map pos;        /* Value -> topological position */
+    uint32_t *repl;     /* position of the node computing the same value */
+    uint8_t *op;        /* Op_Kind after rewriting */
+    uint8_t *flags;
+    uint32_t *key_a;    /* operand positions, or a constant's bits */
+    uint32_t *key_b;
+    uint32_t *exprs;    /* hash set of positions by (op, key_a, key_b), +1 */
+    size_t mask;
+} Lowering;
+
+static uint32_t pos_of(const Lowering *lw, const Value *v) {
+    return lw->repl[reg_map_get(&lw->pos, v)];
+}
+
+static bool is_constant(const Lowering *lw, uint32_t i, mg_real x) {
+    return (lw->flags[i] & NODE_CONST) && lw->topo[i]->data == x;
+}
+
+/* First position with the key of i, i itself if it is new */
+static uint32_t expr_intern(Lowering *lw, uint32_t i) {
+    uint64_t h = (uint64_t)lw->key_a[i] * 0x9E3779B97F4A7C15ull ^ (uint64_t)lw->key_b[i] * 0xC2B2AE3D27D4EB4Full ^ lw->op[i];
+    for (size_t s = hash_u64(h) & lw->mask;; s = (s + 1) & lw->mask) {
+        uint32_t j = lw->exprs[s];
+        if (j == 0) {
+            lw->exprs[s] = i + 1;
+            return i;
+        }
+        j -= 1;
+        if (lw->op[j] == lw->op[i] && lw->key_a[j] == lw->key_a[i] && lw->key_b[j] == lw->key_b[i]) return j;
+    }
+}
+
+static uint32_t intern_constant(Lowering *lw, uint32_t i) {
+    uint64_t bits = 0;
+    mg_real x = lw->topo[i]->data;
+    memcpy(&bits, &x, sizeof(x));
+
+    lw->op[i] = OP_NONE;
+    lw->flags[i] = NODE_CONST;
+    lw->key_a[i] = (uint32_t)bits;
+    lw->key_b[i] = (uint32_t)(bits >> 32);
+    return expr_intern(lw, i);
+}
+
+static bool is_unary(Op_Kind op) {
+    return op == OP_NEG || op == OP_EXP || op == OP_LOG || op == OP_TANH ||
+           op == OP_RELU || op == OP_SIGMOID || op == OP_SQUARE;
+}
+
+static bool is_binary(Op_Kind op) {
+    return op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV || op == OP_POW;
+}
+
+static void lowering_simplify(Lowering *lw, const Reg_Map *marked) {
+    for (uint32_t i = 0; i < lw->n_topo; ++i) {
+        Value *v = lw->topo[i];
+        lw->repl[i] = i;
+        lw->op[i] = (uint8_t)v->op;
+        lw->flags[i] = 0;
+
+        if (v->op == OP_NONE) {
+            if (reg_map_get(marked, v) == REG_NONE) lw->repl[i] = intern_constant(lw, i);
+            continue;
+        }
+        if (v->op == OP_OUTPUT || is_layer_run(v->op)) continue;
+
+        bool all_const = true;
+        for (size_t j = 0; j < v->n_prev; ++j) {
+            all_const = all_const && (lw->flags[pos_of(lw, v->prev[j])] & NODE_CONST);
+        }
+        if (all_const) {
+            lw->repl[i] = intern_constant(lw, i);
+            continue;
+        }
+
+        if (!is_unary(v->op) && !is_binary(v->op)) continue;
+
+        uint32_t a = pos_of(lw, v->prev[0]);
+        uint32_t b = is_binary(v->op) ? pos_of(lw, v->prev[1]) : REG_NONE;
+
+        switch (v->op) {
+            case OP_ADD:
+                if (is_constant(lw, a, 0)) { lw->repl[i] = b; continue; }
+                if (is_constant(lw, b, 0)) { lw->repl[i] = a; continue; }
+                break;
+            case OP_SUB:
+                if (is_constant(lw, b, 0)) { lw->repl[i] = a; continue; }
+                break;
+            case OP_MUL:
+                if (is_constant(lw, a, 1)) { lw->repl[i] = b; continue; }
+                if (is_constant(lw, b, 1)) { lw->repl[i] = a; continue; }
+                break;
+            case OP_DIV:
+                if (is_constant(lw, b, 1)) { lw->repl[i] = a; continue; }
+                break;
+            case OP_POW:
+                if (is_constant(lw, b, 1)) { lw->repl[i] = a; continue; }
+                if (is_constant(lw, b, 2)) {
+                    lw->op[i] = OP_SQUARE;
+                    b = REG_NONE;
+                }
+                break;
+            default:
+                break;
+        }
+
+        // Commutative operands in a fixed order so a + b and b + a meet
+        if ((v->op == OP_ADD || v->op == OP_MUL) && b < a) {
+            uint32_t t = a;
+            a = b;
+            b = t;
+        }
+        lw->key_a[i] = a;
+        lw->key_b[i] = b;
+        lw->repl[i] = expr_intern(lw, i);
+    }
+}
+
+/* Mark what the root reads, walking consumers before their operands */
+static void lowering_live(Lowering *lw, const Value *root) {
+    lw->flags[pos_of(lw, root)] |= NODE_LIVE;
+
+    for (size_t i = lw->n_topo; i-- > 0;) {
+        Value *v = lw->topo[i];
+        if (!(lw->flags[i] & NODE_LIVE) || (lw->flags[i] & NODE_CONST)) continue;
+
+        if (v->op == OP_OUTPUT) {
+            lw->flags[reg_map_get(&lw->pos, v->prev[0])] |= NODE_LIVE;
+        } else if (lw->op[i] == OP_SQUARE) {
+            lw->flags[pos_of(lw, v->prev[0])] |= NODE_LIVE;
+        } else {
+            for (size_t j = 0; j < v->n_prev; ++j) lw->flags[pos_of(lw, v->prev[j])] |= NODE_LIVE;
+        }
+    }
+}
+
+Program *program_compile(Arena *a, Value *root, Value **inputs, size_t n_inputs, Value **params, size_t n_params) {
+    Arena tmp = {0};
+
+    size_t n_topo;
+    Value **topo = value_topo_sort(&tmp, root, &n_topo);
+
+    // Marked leaves first, in the caller's order
+    Reg_Map map;
+    reg_map_init(&tmp, &map, n_inputs + n_params);
+
+    Reg n_regs = 0;
+    for (size_t i = 0; i < n_inputs + n_params; ++i) {
+        Value *v = i < n_inputs ? inputs[i] : params[i - n_inputs];
+        if (v->op != OP_NONE || reg_map_get(&map, v) != REG_NONE) {
+            fprintf(stderr, "program_compile: inputs and params must be distinct leaves\n");
+            exit(1);
+        }
+        reg_map_put(&map, v, n_regs++);
+    }
+
+    Lowering lw = { .topo = topo, .n_topo = n_topo };
+    reg_map_init(&tmp, &lw.pos, n_topo);
+    for (size_t i = 0; i < n_topo; ++i) reg_map_put(&lw.pos, topo[i], (Reg)i);
+
+    lw.repl = arena_alloc(&tmp, sizeof(uint32_t) * (n_topo + 1));
+    lw.op = arena_alloc(&tmp, sizeof(uint8_t) * (n_topo + 1));
+    lw.flags = arena_alloc(&tmp, sizeof(uint8_t) * (n_topo + 1));
+    lw.key_a = arena_alloc(&tmp, sizeof(uint32_t) * (n_topo + 1));
+    lw.key_b = arena_alloc(&tmp, sizeof(uint32_t) * (n_topo + 1));
+    size_t cap = 16;
+    while (cap < 2 * n_topo) cap *= 2;
+    lw.exprs = arena_alloc(&tmp, sizeof(uint32_t) * cap);
+    memset(lw.exprs, 0, sizeof(uint32_t) * cap);
+    lw.mask = cap - 1;
+
+    lowering_simplify(&lw, &map);
+    lowering_live(&lw, root);
+
+    // Registers by position: marked leaves, live constants, then interior
+    Reg *regs = arena_alloc(&tmp, sizeof(Reg) * (n_topo + 1));
+    for (size_t i = 0; i < n_topo; ++i) regs[i] = reg_map_get(&map, topo[i]);
+
+    size_t n_consts = 0;
+    for (size_t i = 0; i < n_topo; ++i) {
+        if ((lw.flags[i] & NODE_LIVE) && (lw.flags[i] & NODE_CONST)) {
+            regs[i] = n_regs++;
+            n_consts++;
+        }
+    }
+
+    Instr_Da code = {0};
+    Reg_Da args = {0};
+    Layer_Da layers = {0};
+    U32_Da run_layers = {0};
+    Run_Da runs = {0};
+
+#define REG_OF(v) regs[pos_of(&lw, (v))]
+
+    for (size_t i = 0; i < n_topo; ++i) {
+        Value *v = topo[i];
+        if (!(lw.flags[i] & NODE_LIVE) || (lw.flags[i] & NODE_CONST)) continue;
+        if (v->op == OP_NONE || v->op == OP_OUTPUT) continue;
+
+        Program_Instr in = { .op = lw.op[i], .dst = n_regs };
+
+        switch ((Op_Kind)lw.op[i]) {
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+                in.a = REG_OF(v->prev[0]);
+                in.b = REG_OF(v->prev[1]);
+                n_regs++;
+                break;
+            case OP_NEG: case OP_EXP: case OP_LOG: case OP_TANH: case OP_RELU: case OP_SIGMOID: case OP_SQUARE:
+                in.a = REG_OF(v->prev[0]);
+                n_regs++;
+                break;
+            case OP_DOT_BIAS:
+            case OP_SOFTMAX_CE: {
+                // dot: w, x then b; softmax: the logits, target in b
+                size_t n_args = v->op == OP_DOT_BIAS ? v->n_prev : v->n_prev - 1;
+                in.a = (Reg)args.count;
+                in.n = (uint32_t)(v->op == OP_DOT_BIAS ? v->n_prev / 2 : n_args);
+                for (size_t j = 0; j < n_args; ++j) {
+                    arena_da_append(&tmp, &args, REG_OF(v->prev[j]));
+                }
+                if (v->op == OP_SOFTMAX_CE) in.b = REG_OF(v->prev[v->n_prev - 1]);
+                n_regs++;
+                break;
+            }
+            case OP_DENSE:
+            case OP_CHECKPOINT: {
+                Layer **ls;
+                Value **outs;
+                size_t n_layers = fused_layers(v, &ls, &outs);
+
+                in.a = (Reg)args.count;
+                in.n = (uint32_t)runs.count;
+                for (size_t j = 0; j < v->n_prev; ++j) {
+                    arena_da_append(&tmp, &args, REG_OF(v->prev[j]));
+                }
+
+                Program_Run run = { .first = (uint32_t)run_layers.count, .count = (uint32_t)n_layers };
+                for (size_t j = 0; j < n_layers; ++j) {
+                    arena_da_append(&tmp, &run_layers, layer_index(&tmp, &layers, ls[j]));
+                }
+                arena_da_append(&tmp, &runs, run);
+
+                // The outputs are the registers right after dst, unread ones included
+                size_t n_out = ls[n_layers - 1]->n_out;
+                for (size_t j = 0; j < n_out; ++j) {
+                    Reg o = reg_map_get(&lw.pos, outs[j]);
+                    if (o != REG_NONE) regs[o] = n_regs;
+                    n_regs++;
+                }
+                break;
+            }
+            default:
+                fprintf(stderr, "program_compile: unsupported op %d\n", (int)v->op);
+                exit(1);
+        }
+
+        if (!is_layer_run(in.op)) regs[i] = in.dst;
+        arena_da_append(&tmp, &code, in);
+    }
+
+    Program *p = arena_alloc(a, sizeof(Program));
+    memset(p, 0, sizeof(*p));
+    p->n_regs = n_regs;
+    p->n_inputs = n_inputs;
+    p->n_params = n_params;
+    p->n_consts = n_consts;
+    p->root = REG_OF(root);
+
+#undef REG_OF
+
+    p->data = arena_alloc(a, sizeof(mg_real) * (n_regs ? n_regs : 1));
+    p->grad = arena_alloc(a, sizeof(mg_real) * (n_regs ? n_regs : 1));
+    memset(p->grad, 0, sizeof(mg_real) * n_regs);
+
+    // Leaf and folded data; interior registers are filled by the first forward
+    memset(p->data, 0, sizeof(mg_real) * n_regs);
+    for (size_t i = 0; i < n_topo; ++i) {
+        if ((lw.flags[i] & NODE_LIVE) && (lw.flags[i] & NODE_CONST)) p->data[regs[i]] = topo[i]->data;
+    }
+    for (size_t i = 0; i < n_inputs; ++i) p->data[i] = inputs[i]->data;
+    for (size_t i = 0; i < n_params; ++i) p->data[n_inputs + i] = params[i]->data;
+
+    p->params = arena_alloc(a, sizeof(Value*) * (n_params ? n_params : 1));
+    if (n_params) memcpy(p->params, params, sizeof(Value*) * n_params);
+
+    p->n_code = code.count;
+    p->code = arena_alloc(a, sizeof(Program_Instr) * (code.count ? code.count : 1));
+    if (code.count) memcpy(p->code, code.items, sizeof(Program_Instr) * code.count);
+
+    p->n_args = args.count;
+    p->args = arena_alloc(a, sizeof(Reg) * (args.count ? args.count : 1));
+    if (args.count) memcpy(p->args, args.items, sizeof(Reg) * args.count);
+
+    p->n_layers = layers.count;
+    p->layers = arena_alloc(a, sizeof(Layer*) * (layers.count ? layers.count : 1));
+    if (layers.count) memcpy(p->layers, layers.items, sizeof(Layer*) * layers.count);
+
+    p->n_run_layers = run_layers.count;
+    p->run_layers = arena_alloc(a, sizeof(uint32_t) * (run_layers.count ? run_layers.count : 1));
+    if (run_layers.count) memcpy(p->run_layers, run_layers.items, sizeof(uint32_t) * run_layers.count);
+
+    p->n_runs = runs.count;
+    p->runs = arena_alloc(a, sizeof(Program_Run) * (runs.count ? runs.count : 1));
+    if (runs.count) memcpy(p->runs, runs.items, sizeof(Program_Run) * runs.count);
+
+    arena_free(&tmp);
+
+    program_finish(a, p);
+    return p;
+}
+
+void program_set_inputs(Program *p, const mg_real *x) {
+    memcpy(p->data, x, sizeof(mg_real) * p->n_inputs);
+}
+
+/* Interpreter */
+
+static void run_forward(Program *p, const Program_Instr *in) {
+    const Program_Run *r = &p->runs[in->n];
+    const Reg *args = &p->args[in->a];
+    mg_real *d = p->data;
+    mg_real *x = p->buf + in->buf;
+    size_t n_in = run_n_in(p, in);
+
+    for (size_t i = 0; i < n_in; ++i) x[i] = d[args[i]];
+
+    // Every layer output is kept after the input for backward
+    const mg_real *cur = x;
+    mg_real *y = x + n_in;
+    size_t n_out = n_in;
+    for (size_t i = 0; i < r->count; ++i) {
+        Layer *l = p->layers[p->run_layers[r->first + i]];
+        layer_forward_batch(l, cur, y, 1);
+        cur = y;
+        n_out = l->n_out;
+        y += n_out;
+    }
+
+    memcpy(&d[in->dst], cur, sizeof(mg_real) * n_out);
+}
+
+static void run_backward(Program *p, const Program_Instr *in) {
+    const Program_Run *r = &p->runs[in->n];
+    const Reg *args = &p->args[in->a];
+    mg_real *x = p->buf + in->buf;
+    size_t n_in = run_n_in(p, in);
+    size_t n_out = run_n_out(p, in);
+
+    // Offset of the last layer's output in the scratch
+    size_t off = n_in;
+    for (size_t i = 0; i + 1 < r->count; ++i) off += p->layers[p->run_layers[r->first + i]]->n_out;
+
+    mg_real *g = p->g[0];
+    mg_real *dx = p->g[1];
+    memcpy(g, &p->grad[in->dst], sizeof(mg_real) * n_out);
+
+    for (size_t i = r->count; i-- > 0;) {
+        Layer *l = p->layers[p->run_layers[r->first + i]];
+        const mg_real *y = x + off;
+        off -= l->n_in;
+        bool last = i == 0 && !(in->flags & PROGRAM_GRAD_IN);
+
+        layer_backward_batch(l, x + off, y, g, last ? NULL : dx, 1);
+
+        mg_real *tmp = g;
+        g = dx;
+        dx = tmp;
+    }
+
+    if (in->flags & PROGRAM_GRAD_IN) {
+        for (size_t i = 0; i < n_in; ++i) p->grad[args[i]] += g[i];
+    }
+}
+
+static void interpret_forward(Program *p) {
+    mg_real *d = p->data;
+
+    for (size_t k = 0; k < p->n_code; ++k) {
+        const Program_Instr *in = &p->code[k];
+        Reg a = in->a, b = in->b;
+
+        switch ((Op_Kind)in->op) {
+            case OP_ADD:     d[in->dst] = d[a] + d[b]; break;
+            case OP_SUB:     d[in->dst] = d[a] - d[b]; break;
+            case OP_MUL:     d[in->dst] = d[a] * d[b]; break;
+            case OP_DIV:     d[in->dst] = d[a] / d[b]; break;
+            case OP_POW:     d[in->dst] = pow(d[a], d[b]); break;
+            case OP_NEG:     d[in->dst] = -d[a]; break;
+            case OP_EXP:     d[in->dst] = exp(d[a]); break;
+            case OP_LOG:     d[in->dst] = log(d[a]); break;
+            case OP_TANH:    d[in->dst] = tanh(d[a]); break;
+            case OP_RELU:    d[in->dst] = d[a] < 0 ? 0 : d[a]; break;
+            case OP_SIGMOID: d[in->dst] = 1 / (1 + exp(-d[a])); break;
+            case OP_SQUARE:  d[in->dst] = d[a] * d[a]; break;
+            case OP_DOT_BIAS: {
+                const Reg *w = &p->args[a];
+                const Reg *x = w + in->n;
+                mg_real sum = 0;
+                for (size_t i = 0; i < in->n; ++i) sum += d[w[i]] * d[x[i]];
+                d[in->dst] = sum + d[x[in->n]];
+                break;
+            }
+            case OP_SOFTMAX_CE: {
+                // Logits, then p - onehot kept for backward
+                mg_real *z = p->buf + in->buf;
+                const Reg *logits = &p->args[a];
+                for (size_t i = 0; i < in->n; ++i) z[i] = d[logits[i]];
+                size_t target = d[b] < 0 ? in->n : (size_t)d[b];
+                d[in->dst] = softmax_cross_entropy_batch(z, &target, 1, in->n, z + in->n);
+                break;
+            }
+            case OP_DENSE:
+            case OP_CHECKPOINT:
+                run_forward(p, in);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void interpret_backward(Program *p) {
+    const mg_real *d = p->data;
+    mg_real *g = p->grad;
+
+    for (size_t r = 0; r < p->n_reverse; ++r) {
+        const Program_Instr *in = &p->code[p->reverse[r]];
+        Reg a = in->a, b = in->b;
+        bool ga = in->flags & PROGRAM_GRAD_A, gb = in->flags & PROGRAM_GRAD_B;
+        mg_real gd = g[in->dst];
+
+        switch ((Op_Kind)in->op) {
+            case OP_ADD:
+                if (ga) g[a] += gd;
+                if (gb) g[b] += gd;
+                break;
+            case OP_SUB:
+                if (ga) g[a] += gd;
+                if (gb) g[b] -= gd;
+                break;
+            case OP_MUL:
+                if (ga) g[a] += d[b] * gd;
+                if (gb) g[b] += d[a] * gd;
+                break;
+            case OP_DIV:
+                if (ga) g[a] += (1 / d[b]) * gd;
+                if (gb) g[b] += (-d[a] / (d[b] * d[b])) * gd;
+                break;
+            case OP_POW:
+                if (ga) g[a] += d[b] * pow(d[a], d[b] - 1) * gd;
+                if (!gb) break;
+                if (d[a] > 0) {
+                    g[b] += d[in->dst] * log(d[a]) * gd;
+                } else {
+                    g[b] = NAN;
+                }
+                break;
+            case OP_NEG:     g[a] -= gd; break;
+            case OP_EXP:     g[a] += d[in->dst] * gd; break;
+            case OP_LOG:     g[a] += (1 / d[a]) * gd; break;
+            case OP_TANH:    g[a] += (1 - d[in->dst] * d[in->dst]) * gd; break;
+            case OP_RELU:    if (d[a] > 0) g[a] += gd; break;
+            case OP_SIGMOID: g[a] += d[in->dst] * (1 - d[in->dst]) * gd; break;
+            case OP_SQUARE:  g[a] += 2 * d[a] * gd; break;
+            case OP_DOT_BIAS: {
+                const Reg *w = &p->args[a];
+                const Reg *x = w + in->n;
+                for (size_t i = 0; i < in->n; ++i) {
+                    g[w[i]] += d[x[i]] * gd;
+                    g[x[i]] += d[w[i]] * gd;
+                }
+                g[x[in->n]] += gd;
+                break;
+            }
+            case OP_SOFTMAX_CE: {
+                const mg_real *dz = p->buf + in->buf + in->n;
+                const Reg *logits = &p->args[a];
+                for (size_t i = 0; i < in->n; ++i) g[logits[i]] += dz[i] * gd;
+                break;
+            }
+            case OP_DENSE:
+            case OP_CHECKPOINT:
+                run_backward(p, in);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* Current weight pointers of every layer for the native code */
+static mg_real *const *jit_weights(Program *p) {
+    mg_real **w = p->jit->w;
+    for (size_t i = 0; i < p->n_layers; ++i) {
+        Layer *l = p->layers[i];
+        w[4 * i + 0] = l->w;
+        w[4 * i + 1] = l->b;
+        w[4 * i + 2] = l->dw;
+        w[4 * i + 3] = l->db;
+    }
+    return w;
+}
+
+mg_real program_forward(Program *p) {
+    trace_begin("program_forward");
+    mg_real *d = p->data;
+
+    for (size_t i = 0; i < p->n_params; ++i) {
+        d[p->n_inputs + i] = p->params[i]->data;
+    }
+
+    // The interpreter reports what the native code refused to run
+    if (p->jit) {
+        if (p->jit->forward(d, p->buf, jit_weights(p)) != 0) interpret_forward(p);
+    } else {
+        interpret_forward(p);
+    }
+
+    trace_end();
+    return d[p->root];
+}
+
+void program_backward(Program *p) {
+    trace_begin("program_backward");
+    mg_real *g = p->grad;
+
+    memset(g, 0, sizeof(mg_real) * p->n_regs);
+    g[p->root] = 1;
+
+    if (p->jit) {
+        p->jit->backward(p->data, g, p->buf, p->g[0], p->g[1], jit_weights(p));
+    } else {
+        interpret_backward(p);
+    }
+
+    for (size_t i = 0; i < p->n_params; ++i) {
+        p->params[i]->grad += g[p->n_inputs + i];
+    }
+    trace_end();
+}
+
+mg_real program_run(Program *p) {
+    mg_real loss = program_forward(p);
+    program_backward(p);
+    return loss;
+}
+
+/*
+ * Program files: a header, then code, args, run layers, runs, the shapes
+ * of the layer table and the register file's leaf data (inputs, params and
+ * constants), each as a plain array.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t real_size;
+    uint32_t root;
+    uint64_t n_regs, n_inputs, n_params, n_consts;
+    uint64_t n_code, n_args, n_layers, n_run_layers, n_runs;
+} Program_Header;
+
+typedef struct {
+    uint32_t n_in;
+    uint32_t n_out;
+    uint32_t act;
+} Program_Layer;
+
+int program_save(const Program *p, const char *filename) {
+    FILE *f = fopen(filename, "wb");
+    if (!f) return -1;
+
+    Program_Header h = {
+        .magic = PROGRAM_FILE_MAGIC,
+        .version = PROGRAM_FILE_VERSION,
+        .real_size = MG_REAL_SIZE,
+        .root = p->root,
+        .n_regs = p->n_regs,
+        .n_inputs = p->n_inputs,
+        .n_params = p->n_params,
+        .n_consts = p->n_consts,
+        .n_code = p->n_code,
+        .n_args = p->n_args,
+        .n_layers = p->n_layers,
+        .n_run_layers = p->n_run_layers,
+        .n_runs = p->n_runs,
+    };
+
+    size_t n_leaves = p->n_inputs + p->n_params + p->n_consts;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(p->code, sizeof(Program_Instr), p->n_code, f) == p->n_code &&
+             fwrite(p->args, sizeof(Reg), p->n_args, f) == p->n_args &&
+             fwrite(p->run_layers, sizeof(uint32_t), p->n_run_layers, f) == p->n_run_layers &&
+             fwrite(p->runs, sizeof(Program_Run), p->n_runs, f) == p->n_runs &&
+             fwrite(p->data, sizeof(mg_real), n_leaves, f) == n_leaves;
+
+    for (size_t i = 0; ok && i < p->n_layers; ++i) {
+        const Layer *l = p->layers[i];
+        Program_Layer pl = { (uint32_t)l->n_in, (uint32_t)l->n_out, (uint32_t)l->act };
+        ok = fwrite(&pl, sizeof(pl), 1, f) == 1;
+    }
+
+    if (fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/* Takes count elements of size bytes off the rest of the file, false when they don't fit */
+static bool file_take(uint64_t *rest, uint64_t count, size_t size) {
+    if (count > *rest / size) return false;
+    *rest -= count * size;
+    return true;
+}
+
+/*
+ * The arrays the header declares must be in the file, before anything is
+ * sized by them. Interior registers are written by the code, at most
+ * widest (the widest bound layer output) per instruction.
+ */
+static bool program_fits(FILE *f, const Program_Header *h, size_t widest) {
+    long start = ftell(f);
+    if (start < 0 || fseek(f, 0, SEEK_END) != 0) return false;
+    long end = ftell(f);
+    if (end < start || fseek(f, start, SEEK_SET) != 0) return false;
+
+    uint64_t rest = (uint64_t)(end - start);
+    return h->n_regs < REG_NONE &&
+           file_take(&rest, h->n_code, sizeof(Program_Instr)) &&
+           file_take(&rest, h->n_args, sizeof(Reg)) &&
+           file_take(&rest, h->n_run_layers, sizeof(uint32_t)) &&
+           file_take(&rest, h->n_runs, sizeof(Program_Run)) &&
+           file_take(&rest, h->n_inputs, sizeof(mg_real)) &&
+           file_take(&rest, h->n_params, sizeof(mg_real)) &&
+           file_take(&rest, h->n_consts, sizeof(mg_real)) &&
+           file_take(&rest, h->n_layers, sizeof(Program_Layer)) &&
+           h->n_inputs + h->n_params + h->n_consts <= h->n_regs &&
+           h->n_regs - h->n_inputs - h->n_params - h->n_consts <= h->n_code * widest;
+}
+
+/*
+ * Every register, operand, run and layer a loaded program names must exist,
+ * and the layers of a run must chain; program_finish and the interpreter
+ * index with them unchecked.
+ */
+static bool program_valid(const Program *p) {
+    size_t n_leaves = p->n_inputs + p->n_params + p->n_consts;
+    if (n_leaves > p->n_regs || p->root >= p->n_regs) return false;
+
+    for (size_t i = 0; i < p->n_run_layers; ++i) {
+        if (p->run_layers[i] >= p->n_layers) return false;
+    }
+    for (size_t i = 0; i < p->n_runs; ++i) {
+        const Program_Run *r = &p->runs[i];
+        if (r->count == 0 || r->first > p->n_run_layers || r->count > p->n_run_layers - r->first) return false;
+        for (size_t j = 1; j < r->count; ++j) {
+            const Layer *prev = p->layers[p->run_layers[r->first + j - 1]];
+            if (p->layers[p->run_layers[r->first + j]]->n_in != prev->n_out) return false;
+        }
+    }
+
+    uint64_t buf_size = 0;
+    for (size_t k = 0; k < p->n_code; ++k) {
+        const Program_Instr *in = &p->code[k];
+        size_t n_args = 0;  /* operands in args[a..] */
+        size_t n_dst = 1;
+
+        switch ((Op_Kind)in->op) {
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+                if (in->b >= p->n_regs) return false;
+                /* fallthrough */
+            case OP_NEG: case OP_EXP: case OP_LOG: case OP_TANH:
+            case OP_RELU: case OP_SIGMOID: case OP_SQUARE:
+                if (in->a >= p->n_regs) return false;
+                break;
+            case OP_DOT_BIAS:
+                n_args = 2 * (size_t)in->n + 1;
+                break;
+            case OP_SOFTMAX_CE:
+                if (in->n == 0 || in->b >= p->n_regs) return false;
+                n_args = in->n;
+                buf_size += 2 * (uint64_t)in->n;
+                break;
+            case OP_DENSE:
+            case OP_CHECKPOINT: {
+                if (in->n >= p->n_runs) return false;
+                const Program_Run *r = &p->runs[in->n];
+                n_args = run_n_in(p, in);
+                n_dst = run_n_out(p, in);
+                buf_size += n_args;
+                for (size_t i = 0; i < r->count; ++i) buf_size += p->layers[p->run_layers[r->first + i]]->n_out;
+                break;
+            }
+            default:
+                return false;
+        }
+
+        if (n_args) {
+            if (in->a > p->n_args || n_args > p->n_args - in->a) return false;
+            for (size_t i = 0; i < n_args; ++i) {
+                if (p->args[in->a + i] >= p->n_regs) return false;
+            }
+        }
+        if (in->dst >= p->n_regs || n_dst > p->n_regs - in->dst) return false;
+    }
+
+    // Scratch offsets are 32 bit
+    return buf_size <= UINT32_MAX;
+}
+
+Program *program_load(Arena *a, const char *filename, Layer **layers, size_t n_layers, Value **params, size_t n_params) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return NULL;
+
+    Program_Header h;
+    NN_READ_OR_FAIL(&h, sizeof(h), 1, f);
+
+    if (h.magic != PROGRAM_FILE_MAGIC || h.version != PROGRAM_FILE_VERSION || h.real_size != MG_REAL_SIZE) {
+        fprintf(stderr, "program_load: %s is not a version %u program of this precision\n", filename, PROGRAM_FILE_VERSION);
+        fclose(f);
+        return NULL;
+    }
+    if (h.n_layers != n_layers || h.n_params != n_params) {
+        fprintf(stderr, "program_load: expects %llu layers and %llu params (got %zu and %zu)\n",
+                (unsigned long long)h.n_layers, (unsigned long long)h.n_params, n_layers, n_params);
+        fclose(f);
+        return NULL;
+    }
+    size_t widest = 1;
+    for (size_t i = 0; i < n_layers; ++i) {
+        if (layers[i]->n_out > widest) widest = layers[i]->n_out;
+    }
+    if (!program_fits(f, &h, widest)) {
+        fprintf(stderr, "program_load: %s is truncated or its header is corrupt\n", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    Program *p = arena_alloc(a, sizeof(Program));
+    memset(p, 0, sizeof(*p));
+    p->n_regs = h.n_regs;
+    p->n_inputs = h.n_inputs;
+    p->n_params = h.n_params;
+    p->n_consts = h.n_consts;
+    p->root = h.root;
+    p->n_code = h.n_code;
+    p->n_args = h.n_args;
+    p->n_layers = h.n_layers;
+    p->n_run_layers = h.n_run_layers;
+    p->n_runs = h.n_runs;
+
+    p->data = arena_alloc(a, sizeof(mg_real) * (p->n_regs ? p->n_regs : 1));
+    p->grad = arena_alloc(a, sizeof(mg_real) * (p->n_regs ? p->n_regs : 1));
+    memset(p->data, 0, sizeof(mg_real) * p->n_regs);
+    memset(p->grad, 0, sizeof(mg_real) * p->n_regs);
+    p->code = arena_alloc(a, sizeof(Program_Instr) * (p->n_code ? p->n_code : 1));
+    p->args = arena_alloc(a, sizeof(Reg) * (p->n_args ? p->n_args : 1));
+    p->run_layers = arena_alloc(a, sizeof(uint32_t) * (p->n_run_layers ? p->n_run_layers : 1));
+    p->runs = arena_alloc(a, sizeof(Program_Run) * (p->n_runs ? p->n_runs : 1));
+
+    NN_READ_OR_FAIL(p->code, sizeof(Program_Instr), p->n_code, f);
+    NN_READ_OR_FAIL(p->args, sizeof(Reg), p->n_args, f);
+    NN_READ_OR_FAIL(p->run_layers, sizeof(uint32_t), p->n_run_layers, f);
+    NN_READ_OR_FAIL(p->runs, sizeof(Program_Run), p->n_runs, f);
+    NN_READ_OR_FAIL(p->data, sizeof(mg_real), p->n_inputs + p->n_params + p->n_consts, f);
+
+    for (size_t i = 0; i < n_layers; ++i) {
+        Program_Layer pl;
+        NN_READ_OR_FAIL(&pl, sizeof(pl), 1, f);
+        const Layer *l = layers[i];
+        if (pl.n_in != l->n_in || pl.n_out != l->n_out || pl.act != (uint32_t)l->act) {
+            fprintf(stderr, "program_load: layer %zu is %zux%zu, the program expects %ux%u\n",
+                    i, l->n_in, l->n_out, pl.n_in, pl.n_out);
+            fclose(f);
+            return NULL;
+        }
+    }
+    fclose(f);
+
+    p->layers = arena_alloc(a, sizeof(Layer*) * (n_layers ? n_layers : 1));
+    if (n_layers) memcpy(p->layers, layers, sizeof(Layer*) * n_layers);
+    p->params = arena_alloc(a, sizeof(Value*) * (n_params ? n_params : 1));
+    if (n_params) memcpy(p->params, params, sizeof(Value*) * n_params);
+
+    if (!program_valid(p)) {
+        fprintf(stderr, "program_load: %s refers to registers, operands or layers it does not have\n", filename);
+        return NULL;
+    }
+
+    program_finish(a, p);
+    return p;
+}
@@ -0,0 +1,266 @@
+#include "tape.h"
+#include "trace.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+Tape *tape_record(Arena *a, Value *root) {
+    size_t n_topo;
+    Value **nodes = value_topo_sort(a, root, &n_topo);
+
+    /* Leaves have nothing to replay, keep only the interior nodes */
+    size_t n_nodes = 0;
+    for (size_t i = 0; i < n_topo; ++i) {
+        if (nodes[i]->op != OP_NONE) {
+            nodes[n_nodes++] = nodes[i];
+        }
+    }
+
+    Tape *t = arena_alloc(a, sizeof(Tape));
+    t->root = root;
+    t->nodes = nodes;
+    t->n_nodes = n_nodes;
+    return t;
+}
+
+void tape_forward(Tape *t) {
+    trace_begin("tape_forward");
+    for (size_t i = 0; i < t->n_nodes; ++i) {
+        Value *node = t->nodes[i];
+        if (node->forward) {
+            node->forward(node);
+        }
+    }
+    trace_end();
+}
+
+void tape_backward(Tape *t) {
+    trace_begin("tape_backward");
+    for (size_t i = 0; i < t->n_nodes; ++i) {
+        t->nodes[i]->grad = 0.0;
+    }
+
+    t->root->grad = 1.0;
+
+    for (size_t i = t->n_nodes; i-- > 0;) {
+        Value *node = t->nodes[i];
+        if (node->backward) {
+            node->backward(node);
+        }
+    }
+    trace_end();
+}
+
+/*
+ * tape_optimize() state: one slot per node of the graph, keyed by pointer,
+ * and a table of the expressions computed so far, keyed by op and operands
+ * (or by the bits of a constant).
+ */
+typedef struct {
+    const Value *key;   /* NULL for an empty slot */
+    Value *repl;        /* the Value computing the same thing, the node itself if kept */
+    bool var;
+    bool constant;
+    bool live;
+} Tape_Slot;
+
+typedef struct {
+    Value *node;        /* NULL for an empty slot */
+    uint8_t op;
+    const Value *a, *b;
+    uint64_t bits;
+} Tape_Expr;
+
+typedef struct {
+    Tape_Slot *slots;
+    size_t slot_mask;
+    Tape_Expr *exprs;
+    size_t expr_mask;
+} Tape_Pass;
+
+static size_t tape_hash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+static size_t table_size(size_t n) {
+    size_t cap = 16;
+    while (cap < 2 * n) cap *= 2;
+    return cap;
+}
+
+static Tape_Slot *tape_slot(Tape_Pass *p, const Value *v) {
+    size_t i = tape_hash((uint64_t)(uintptr_t)v) & p->slot_mask;
+    while (p->slots[i].key != NULL && p->slots[i].key != v) i = (i + 1) & p->slot_mask;
+    p->slots[i].key = v;
+    return &p->slots[i];
+}
+
+/* First node with the same key, node itself if it is new */
+static Value *tape_intern(Tape_Pass *p, Value *node, Op_Kind op, const Value *a, const Value *b, uint64_t bits) {
+    uint64_t h = (uint64_t)(uintptr_t)a * 0x9E3779B97F4A7C15ull ^ (uint64_t)(uintptr_t)b * 0xC2B2AE3D27D4EB4Full ^
+                 bits * 0x165667B19E3779F9ull ^ (uint64_t)op;
+    for (size_t i = tape_hash(h) & p->expr_mask;; i = (i + 1) & p->expr_mask) {
+        Tape_Expr *e = &p->exprs[i];
+        if (e->node == NULL) {
+            *e = (Tape_Expr){ .node = node, .op = (uint8_t)op, .a = a, .b = b, .bits = bits };
+            return node;
+        }
+        if (e->op == op && e->a == a && e->b == b && e->bits == bits) return e->node;
+    }
+}
+
+static Value *tape_constant(Tape_Pass *p, Value *v) {
+    uint64_t bits = 0;
+    memcpy(&bits, &v->data, sizeof(v->data));
+    return tape_intern(p, v, OP_NONE, NULL, NULL, bits);
+}
+
+static bool is_const(Tape_Pass *p, const Value *v, mg_real x) {
+    return tape_slot(p, v)->constant && v->data == x;
+}
+
+/* x + 0, 0 + x, x - 0, x * 1, 1 * x, x / 1 and x ^ 1 are x, NULL otherwise */
+static Value *tape_identity(Tape_Pass *p, Value *v) {
+    Value *a = v->prev[0];
+    Value *b = v->n_prev > 1 ? v->prev[1] : NULL;
+
+    switch (v->op) {
+        case OP_ADD:
+            if (is_const(p, a, 0)) return b;
+            if (is_const(p, b, 0)) return a;
+            return NULL;
+        case OP_SUB:
+            return is_const(p, b, 0) ? a : NULL;
+        case OP_MUL:
+            if (is_const(p, a, 1)) return b;
+            if (is_const(p, b, 1)) return a;
+            return NULL;
+        case OP_DIV:
+        case OP_POW:
+            return is_const(p, b, 1) ? a : NULL;
+        default:
+            return NULL;
+    }
+}
+
+static bool is_scalar_op(Op_Kind op) {
+    return op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV || op == OP_POW ||
+           op == OP_NEG || op == OP_EXP || op == OP_LOG || op == OP_TANH || op == OP_RELU ||
+           op == OP_SIGMOID || op == OP_SQUARE;
+}
+
+static bool has_weights(Op_Kind op) {
+    return op == OP_DENSE || op == OP_CHECKPOINT || op == OP_OUTPUT;
+}
+
+/* Rewrite v, whose operands are final already, and record what replaces it */
+static void tape_rewrite(Tape_Pass *p, Value *v, bool is_root) {
+    Tape_Slot *s = tape_slot(p, v);
+    s->repl = v;
+
+    bool all_const = v->n_prev > 0 && !has_weights(v->op);
+    for (size_t j = 0; j < v->n_prev; ++j) {
+        all_const = all_const && tape_slot(p, v->prev[j])->constant;
+    }
+    if (all_const) {
+        // Keeps the data it was built with
+        s->constant = true;
+        if (!is_root) s->repl = tape_constant(p, v);
+        return;
+    }
+    if (!is_scalar_op(v->op)) return;
+
+    Value *same = tape_identity(p, v);
+    if (same && !is_root) {
+        s->repl = same;
+        return;
+    }
+
+    if (v->op == OP_POW && is_const(p, v->prev[1], 2)) {
+        value_rewrite_square(v);
+    }
+    if (v->n_prev == 2) {
+        if (tape_slot(p, v->prev[0])->constant) value_stop_grad(v, 0);
+        if (tape_slot(p, v->prev[1])->constant) value_stop_grad(v, 1);
+    }
+
+    // Commutative operands in a fixed order so a + b and b + a meet
+    const Value *a = v->prev[0];
+    const Value *b = v->n_prev == 2 ? v->prev[1] : NULL;
+    if ((v->op == OP_ADD || v->op == OP_MUL) && (uintptr_t)b < (uintptr_t)a) {
+        const Value *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    Value *first = tape_intern(p, v, v->op, a, b, 0);
+    if (!is_root) s->repl = first;
+}
+
+void tape_optimize(Tape *t, Value **vars, size_t n_vars) {
+    trace_begin("tape_optimize");
+    Arena tmp = {0};
+
+    size_t n;
+    Value **topo = value_topo_sort(&tmp, t->root, &n);
+
+    Tape_Pass p = {0};
+    size_t slots = table_size(n + n_vars);
+    size_t exprs = table_size(n);
+    p.slots = arena_alloc(&tmp, sizeof(Tape_Slot) * slots);
+    p.exprs = arena_alloc(&tmp, sizeof(Tape_Expr) * exprs);
+    memset(p.slots, 0, sizeof(Tape_Slot) * slots);
+    memset(p.exprs, 0, sizeof(Tape_Expr) * exprs);
+    p.slot_mask = slots - 1;
+    p.expr_mask = exprs - 1;
+
+    for (size_t i = 0; i < n_vars; ++i) {
+        tape_slot(&p, vars[i])->var = true;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        Value *v = topo[i];
+
+        if (v->op == OP_NONE) {
+            Tape_Slot *s = tape_slot(&p, v);
+            s->repl = v;
+            if (!s->var && v->value_kind != VALUE_INPUT && v->value_kind != VALUE_PARAM) {
+                s->constant = true;
+                s->repl = tape_constant(&p, v);
+            }
+            continue;
+        }
+
+        for (size_t j = 0; j < v->n_prev; ++j) {
+            v->prev[j] = tape_slot(&p, v->prev[j])->repl;
+        }
+        tape_rewrite(&p, v, v == t->root);
+    }
+
+    // Keep what the root still reads, walking consumers before their operands
+    tape_slot(&p, t->root)->live = true;
+    for (size_t i = n; i-- > 0;) {
+        Value *v = topo[i];
+        Tape_Slot *s = tape_slot(&p, v);
+        if (!s->live || s->constant || s->repl != v) continue;
+        for (size_t j = 0; j < v->n_prev; ++j) {
+            tape_slot(&p, v->prev[j])->live = true;
+        }
+    }
+
+    size_t n_nodes = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Value *v = topo[i];
+        Tape_Slot *s = tape_slot(&p, v);
+        if (v->op != OP_NONE && s->live && !s->constant && s->repl == v) {
+            t->nodes[n_nodes++] = v;
+        }
+    }
+    t->n_nodes = n_nodes;
+
+    arena_free(&tmp);
+    trace_end();
+}
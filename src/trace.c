@@ -0,0 +1,300 @@
+#define _DEFAULT_SOURCE
+#include "trace.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_BUFFER_EVENTS 4096
+
+typedef struct {
+    const char *name;
+    uint64_t start;     /* ns since trace_open */
+    uint64_t dur;
+} Trace_Event;
+
+/*
+ * A thread's track for one recording. trace_close detaches and flushes the
+ * blocks; each one is freed by whichever of trace_close and its thread lets
+ * go of it last (closed / released, under trace_lock).
+ */
+typedef struct Trace_Thread Trace_Thread;
+struct Trace_Thread {
+    Trace_Thread *next;
+    unsigned tid;
+    uint64_t session;
+    char name[32];
+
+    /* Set by the owner while it writes the block, trace_close waits it out */
+    atomic_bool busy;
+    bool closed;        /* flushed by trace_close */
+    bool released;      /* dropped by its thread */
+
+    Trace_Event events[TRACE_BUFFER_EVENTS];
+    size_t count;
+
+    /* Open spans, deeper ones are counted but not recorded */
+    const char *open_name[TRACE_MAX_DEPTH];
+    uint64_t open_start[TRACE_MAX_DEPTH];
+    size_t depth;
+};
+
+static atomic_bool trace_on = false;
+static _Atomic uint64_t trace_session = 0;
+
+/* Guards everything below and the file */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+static size_t trace_written = 0;
+static uint64_t trace_t0 = 0;
+static Trace_Thread *trace_threads = NULL;
+static unsigned trace_next_tid = 1;
+
+/* Releases the block of an exiting thread */
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+
+static _Thread_local Trace_Thread *trace_self = NULL;
+static _Thread_local char trace_self_name[32] = "";
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/* Caller holds trace_lock */
+static void write_separator(void) {
+    fputs(trace_written++ ? ",\n" : "\n", trace_file);
+}
+
+static void flush_events(Trace_Thread *t) {
+    for (size_t i = 0; i < t->count; ++i) {
+        const Trace_Event *e = &t->events[i];
+        write_separator();
+        fputs("{\"name\":", trace_file);
+        write_json_string(trace_file, e->name);
+        fprintf(trace_file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                t->tid, (double)e->start * 1e-3, (double)e->dur * 1e-3);
+    }
+    t->count = 0;
+}
+
+/* Caller holds trace_lock */
+static void release_block(Trace_Thread *t) {
+    if (t->closed) {
+        free(t);
+    } else {
+        t->released = true;
+    }
+}
+
+static void release_on_exit(void *block) {
+    pthread_mutex_lock(&trace_lock);
+    release_block(block);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void create_key(void) {
+    if (pthread_key_create(&trace_key, release_on_exit) != 0) {
+        fprintf(stderr, "trace: failed to create thread key\n");
+        exit(1);
+    }
+}
+
+static Trace_Thread *trace_thread(void) {
+    uint64_t session = atomic_load(&trace_session);
+    if (trace_self && trace_self->session == session) return trace_self;
+
+    pthread_once(&trace_key_once, create_key);
+
+    Trace_Thread *t = calloc(1, sizeof(Trace_Thread));
+    if (!t) {
+        fprintf(stderr, "trace: out of memory\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    // The block of an earlier recording is handed back
+    if (trace_self) release_block(trace_self);
+
+    t->tid = trace_next_tid++;
+    t->session = atomic_load(&trace_session);
+    if (trace_self_name[0]) {
+        memcpy(t->name, trace_self_name, sizeof(t->name));
+    } else {
+        snprintf(t->name, sizeof(t->name), "thread %u", t->tid);
+    }
+    t->next = trace_threads;
+    trace_threads = t;
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_self = t;
+    pthread_setspecific(trace_key, t);
+    return t;
+}
+
+/*
+ * Claim the calling thread's block, NULL once the recording it belongs to is
+ * closing. busy is raised before trace_on is checked again and trace_close
+ * clears trace_on before it waits on busy, so one of them sees the other.
+ */
+static Trace_Thread *trace_enter(void) {
+    Trace_Thread *t = trace_thread();
+    atomic_store(&t->busy, true);
+    if (!atomic_load(&trace_on) || t->session != atomic_load(&trace_session)) {
+        atomic_store_explicit(&t->busy, false, memory_order_release);
+        return NULL;
+    }
+    return t;
+}
+
+static void trace_leave(Trace_Thread *t) {
+    atomic_store_explicit(&t->busy, false, memory_order_release);
+}
+
+int trace_open(const char *path) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file) {
+        pthread_mutex_unlock(&trace_lock);
+        fprintf(stderr, "trace_open: a trace is already being recorded\n");
+        return -1;
+    }
+
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        pthread_mutex_unlock(&trace_lock);
+        perror(path);
+        return -1;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace_file);
+    trace_written = 0;
+    trace_t0 = now_ns();
+
+    write_separator();
+    fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"microgradc\"}}", trace_file);
+
+    atomic_store(&trace_on, true);
+    pthread_mutex_unlock(&trace_lock);
+    return 0;
+}
+
+void trace_close(void) {
+    atomic_store(&trace_on, false);
+
+    // Detach this recording's blocks, threads still holding one see a new session and start over
+    pthread_mutex_lock(&trace_lock);
+    if (!trace_file) {
+        pthread_mutex_unlock(&trace_lock);
+        return;
+    }
+    Trace_Thread *threads = trace_threads;
+    trace_threads = NULL;
+    trace_next_tid = 1;
+    atomic_fetch_add(&trace_session, 1);
+    pthread_mutex_unlock(&trace_lock);
+
+    // Let spans that were being recorded finish
+    for (Trace_Thread *t = threads; t; t = t->next) {
+        while (atomic_load(&t->busy)) sched_yield();
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    while (threads) {
+        Trace_Thread *t = threads;
+        threads = t->next;
+
+        flush_events(t);
+        write_separator();
+        fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", t->tid);
+        write_json_string(trace_file, t->name);
+        fputs("}}", trace_file);
+
+        if (t->released) {
+            free(t);
+        } else {
+            t->closed = true;
+        }
+    }
+
+    fputs("\n]}\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+bool trace_enabled(void) {
+    return atomic_load_explicit(&trace_on, memory_order_relaxed);
+}
+
+void trace_begin(const char *name) {
+    if (!atomic_load_explicit(&trace_on, memory_order_relaxed)) return;
+
+    Trace_Thread *t = trace_enter();
+    if (!t) return;
+    if (t->depth < TRACE_MAX_DEPTH) {
+        t->open_name[t->depth] = name;
+        t->open_start[t->depth] = now_ns() - trace_t0;
+    }
+    t->depth++;
+    trace_leave(t);
+}
+
+void trace_end(void) {
+    if (!atomic_load_explicit(&trace_on, memory_order_relaxed)) return;
+
+    Trace_Thread *t = trace_enter();
+    if (!t) return;
+    if (t->depth == 0 || --t->depth >= TRACE_MAX_DEPTH) {
+        /* opened before trace_open, or too deep to record */
+        trace_leave(t);
+        return;
+    }
+
+    uint64_t start = t->open_start[t->depth];
+    t->events[t->count++] = (Trace_Event){
+        .name = t->open_name[t->depth],
+        .start = start,
+        .dur = now_ns() - trace_t0 - start,
+    };
+
+    // A closing recording flushes the block itself once this thread leaves it
+    if (t->count == TRACE_BUFFER_EVENTS) {
+        pthread_mutex_lock(&trace_lock);
+        if (trace_file && t->session == atomic_load(&trace_session)) flush_events(t);
+        pthread_mutex_unlock(&trace_lock);
+    }
+    trace_leave(t);
+}
+
+void trace_thread_name(const char *name) {
+    snprintf(trace_self_name, sizeof(trace_self_name), "%s", name);
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_self && trace_self->session == atomic_load(&trace_session)) {
+        memcpy(trace_self->name, trace_self_name, sizeof(trace_self->name));
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,295 @@
+#include "trainer.h"
+#include "kernels.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    PHASE_SAMPLES,  /* forward + backward, gradients summed into the worker's slot */
+    PHASE_REDUCE    /* tree-sum the worker slots, split by parameter range */
+} Phase;
+
+typedef struct {
+    Trainer *t;
+    size_t id;
+    Arena graph_arena;
+    Arena replica_arena;
+    MLP *replica;
+    Value **x;      /* input placeholder then the target, in replica_arena */
+} Worker;
+
+struct Trainer {
+    MLP *mlp;
+    size_t n_threads;
+    size_t max_batch;
+    size_t n_params;
+
+    Worker *workers;
+    pthread_t *threads;     /* helpers for workers 1..n_threads-1 */
+
+    mg_real *grads;          /* n_threads x n_params */
+    mg_real *losses;         /* max_batch */
+
+    /* Current job */
+    Phase phase;
+    const size_t *samples;
+    size_t batch_size;
+    Sample_Loss_Fn fn;
+    void *user;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t job;
+    size_t pending;
+    bool quit;
+};
+
+/* Same shapes and weights as m, gradients are rebound per sample */
+static MLP *mlp_replica(Arena *a, MLP *m) {
+    MLP *r = arena_alloc(a, sizeof(MLP));
+    *r = *m;
+    r->map = NULL;
+    r->grads = NULL;
+    r->layers = arena_alloc(a, sizeof(Layer*) * m->layer_size);
+
+    for (size_t i = 0; i < m->layer_size; ++i) {
+        Layer *l = arena_alloc(a, sizeof(Layer));
+        *l = *m->layers[i];
+        l->dw = NULL;
+        l->db = NULL;
+        r->layers[i] = l;
+    }
+    return r;
+}
+
+/* Point the replica's gradients at a zeroed slot laid out as [w0 b0 w1 b1 ...],
+   value_backward() then accumulates every sample into it */
+static void replica_bind(MLP *r, mg_real *slot) {
+    memset(slot, 0, sizeof(mg_real) * r->n_params);
+
+    r->grads = slot;
+    for (size_t i = 0; i < r->layer_size; ++i) {
+        Layer *l = r->layers[i];
+        l->dw = slot + r->offsets[i];
+        l->db = l->dw + l->n_in * l->n_out;
+    }
+}
+
+static void range_of(size_t n, size_t parts, size_t k, size_t *begin, size_t *end) {
+    *begin = n * k / parts;
+    *end = n * (k + 1) / parts;
+}
+
+static void worker_samples(Worker *w) {
+    Trainer *t = w->t;
+    size_t begin, end;
+    range_of(t->batch_size, t->n_threads, w->id, &begin, &end);
+    replica_bind(w->replica, &t->grads[w->id * t->n_params]);
+
+    for (size_t s = begin; s < end; ++s) {
+        trace_begin("sample");
+
+        trace_begin("build graph");
+        Value *loss = t->fn(&w->graph_arena, w->replica, w->x, t->samples[s], t->user);
+        trace_end();
+
+        t->losses[s] = loss->data;
+        value_backward(&w->graph_arena, loss);
+
+        trace_begin("arena_reset");
+        arena_reset(&w->graph_arena);
+        trace_end();
+        trace_end();
+    }
+}
+
+static void worker_reduce(Worker *w) {
+    Trainer *t = w->t;
+    size_t begin, end;
+    range_of(t->n_params, t->n_threads, w->id, &begin, &end);
+
+    trace_begin("reduce");
+    size_t n = t->n_threads;
+    for (size_t stride = 1; stride < n; stride *= 2) {
+        for (size_t s = 0; s + stride < n; s += 2 * stride) {
+            mg_real *dst = &t->grads[s * t->n_params];
+            const mg_real *src = &t->grads[(s + stride) * t->n_params];
+            kernels()->axpy(1.0, src + begin, dst + begin, end - begin);
+        }
+    }
+    trace_end();
+}
+
+static void worker_run(Worker *w) {
+    switch (w->t->phase) {
+        case PHASE_SAMPLES: worker_samples(w); break;
+        case PHASE_REDUCE:  worker_reduce(w); break;
+    }
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    Trainer *t = w->t;
+    uint64_t seen = 0;
+
+    char name[32];
+    snprintf(name, sizeof(name), "trainer worker %zu", w->id);
+    trace_thread_name(name);
+
+    for (;;) {
+        pthread_mutex_lock(&t->lock);
+        while (!t->quit && t->job == seen) {
+            pthread_cond_wait(&t->start, &t->lock);
+        }
+        if (t->quit) {
+            pthread_mutex_unlock(&t->lock);
+            return NULL;
+        }
+        seen = t->job;
+        pthread_mutex_unlock(&t->lock);
+
+        worker_run(w);
+
+        pthread_mutex_lock(&t->lock);
+        if (--t->pending == 0) {
+            pthread_cond_signal(&t->done);
+        }
+        pthread_mutex_unlock(&t->lock);
+    }
+}
+
+/* Run one phase on every worker, the caller works as worker 0 */
+static void trainer_dispatch(Trainer *t, Phase phase) {
+    pthread_mutex_lock(&t->lock);
+    t->phase = phase;
+    t->pending = t->n_threads - 1;
+    t->job++;
+    pthread_cond_broadcast(&t->start);
+    pthread_mutex_unlock(&t->lock);
+
+    worker_run(&t->workers[0]);
+
+    pthread_mutex_lock(&t->lock);
+    while (t->pending > 0) {
+        pthread_cond_wait(&t->done, &t->lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+Trainer *trainer_create(MLP *m, size_t n_threads, size_t max_batch) {
+    if (n_threads == 0) n_threads = 1;
+
+    Trainer *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+
+    t->mlp = m;
+    t->n_threads = n_threads;
+    t->max_batch = max_batch;
+    t->n_params = m->n_params;
+
+    if (t->n_params && n_threads > SIZE_MAX / sizeof(mg_real) / t->n_params) {
+        free(t);
+        return NULL;
+    }
+    t->grads = malloc(sizeof(mg_real) * n_threads * t->n_params);
+    t->losses = malloc(sizeof(mg_real) * max_batch);
+    t->workers = calloc(n_threads, sizeof(Worker));
+    t->threads = calloc(n_threads, sizeof(pthread_t));
+    if (!t->grads || !t->losses || !t->workers || !t->threads) {
+        free(t->grads);
+        free(t->losses);
+        free(t->workers);
+        free(t->threads);
+        free(t);
+        return NULL;
+    }
+
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->start, NULL);
+    pthread_cond_init(&t->done, NULL);
+
+    for (size_t i = 0; i < n_threads; ++i) {
+        Worker *w = &t->workers[i];
+        w->t = t;
+        w->id = i;
+        w->replica = mlp_replica(&w->replica_arena, m);
+        w->x = value_alloc_input(&w->replica_arena, (m->layer_size ? m->layers[0]->n_in : 0) + 1);
+    }
+
+    for (size_t i = 1; i < n_threads; ++i) {
+        if (pthread_create(&t->threads[i], NULL, worker_main, &t->workers[i]) != 0) {
+            fprintf(stderr, "trainer_create: failed to start worker %zu\n", i);
+            exit(1);
+        }
+    }
+
+    return t;
+}
+
+void trainer_destroy(Trainer *t) {
+    if (!t) return;
+
+    pthread_mutex_lock(&t->lock);
+    t->quit = true;
+    pthread_cond_broadcast(&t->start);
+    pthread_mutex_unlock(&t->lock);
+
+    for (size_t i = 1; i < t->n_threads; ++i) {
+        pthread_join(t->threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < t->n_threads; ++i) {
+        arena_free(&t->workers[i].graph_arena);
+        arena_free(&t->workers[i].replica_arena);
+    }
+
+    pthread_cond_destroy(&t->done);
+    pthread_cond_destroy(&t->start);
+    pthread_mutex_destroy(&t->lock);
+
+    free(t->grads);
+    free(t->losses);
+    free(t->workers);
+    free(t->threads);
+    free(t);
+}
+
+void trainer_reserve(Trainer *t, size_t bytes) {
+    for (size_t i = 0; i < t->n_threads; ++i) {
+        arena_reserve(&t->workers[i].graph_arena, bytes);
+    }
+}
+
+mg_real trainer_step(Trainer *t, const size_t *samples, size_t batch_size, Sample_Loss_Fn fn, void *user) {
+    if (batch_size == 0) return 0.0;
+    if (batch_size > t->max_batch) {
+        fprintf(stderr, "trainer_step: batch too large (max %zu got %zu)\n", t->max_batch, batch_size);
+        exit(1);
+    }
+
+    t->samples = samples;
+    t->batch_size = batch_size;
+    t->fn = fn;
+    t->user = user;
+
+    trace_begin("trainer_step");
+    trainer_dispatch(t, PHASE_SAMPLES);
+    trainer_dispatch(t, PHASE_REDUCE);
+
+    /* Slot 0 now holds the batch sum, laid out like the MLP's gradients */
+    mg_real scale = 1.0 / (mg_real)batch_size;
+    kernels()->axpy(scale, t->grads, t->mlp->grads, t->n_params);
+    trace_end();
+
+    mg_real total_loss = 0.0;
+    for (size_t s = 0; s < batch_size; ++s) {
+        total_loss += t->losses[s];
+    }
+    return total_loss * scale;
+}
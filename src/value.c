@@ -1,10 +1,13 @@
 
 #include "value.h"
 #include "arena.h"
-#include "stack.h"
+#include "profile.h"
+#include "trace.h"
 
-#include <math.h>
+#include <tgmath.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void backward_add(Value *v) {
     v->prev[0]->grad += v->grad;
@@ -45,6 +48,15 @@ static void backward_pow(Value *v) {
     }
 }
 
+/**
+ * y = a^2
+ * dy/da = 2a
+ */
+static void backward_square(Value *v) {
+    Value *a = v->prev[0];
+    a->grad += 2 * a->data * v->grad;
+}
+
 /**
  * y = e^x
  * dy/dx = e^x = y
@@ -98,21 +110,179 @@ static void backward_relu(Value *v) {
     } 
 }
 
-Value *value_alloc(Arena *a, double data) {
+/*
+ * One-sided rules for a binary node whose other operand is a constant,
+ * see value_stop_grad(). _a writes only prev[0], _b only prev[1].
+ */
+static void backward_add_a(Value *v) {
+    v->prev[0]->grad += v->grad;
+}
+
+static void backward_add_b(Value *v) {
+    v->prev[1]->grad += v->grad;
+}
+
+static void backward_sub_b(Value *v) {
+    v->prev[1]->grad += -v->grad;
+}
+
+static void backward_mul_a(Value *v) {
+    v->prev[0]->grad += v->prev[1]->data * v->grad;
+}
+
+static void backward_mul_b(Value *v) {
+    v->prev[1]->grad += v->prev[0]->data * v->grad;
+}
+
+static void backward_div_a(Value *v) {
+    v->prev[0]->grad += (1 / v->prev[1]->data) * v->grad;
+}
+
+static void backward_div_b(Value *v) {
+    Value *a = v->prev[0];
+    Value *b = v->prev[1];
+    b->grad += (-a->data / (b->data * b->data)) * v->grad;
+}
+
+/* A constant exponent skips the log of backward_pow */
+static void backward_pow_a(Value *v) {
+    Value *a = v->prev[0];
+    Value *b = v->prev[1];
+    a->grad += (b->data) * pow(a->data, b->data - 1) * v->grad;
+}
+
+static void backward_pow_b(Value *v) {
+    Value *a = v->prev[0];
+    Value *b = v->prev[1];
+
+    if (a->data > 0) {
+        b->grad += v->data * log(a->data) * v->grad;
+    } else {
+        b->grad = NAN;
+    }
+}
+
+/* Forward rules, used to recompute a node in place when its inputs change */
+static void forward_add(Value *v) {
+    v->data = v->prev[0]->data + v->prev[1]->data;
+}
+
+static void forward_sub(Value *v) {
+    v->data = v->prev[0]->data - v->prev[1]->data;
+}
+
+static void forward_mul(Value *v) {
+    v->data = v->prev[0]->data * v->prev[1]->data;
+}
+
+static void forward_neg(Value *v) {
+    v->data = -v->prev[0]->data;
+}
+
+static void forward_pow(Value *v) {
+    v->data = pow(v->prev[0]->data, v->prev[1]->data);
+}
+
+static void forward_square(Value *v) {
+    v->data = v->prev[0]->data * v->prev[0]->data;
+}
+
+static void forward_exp(Value *v) {
+    v->data = exp(v->prev[0]->data);
+}
+
+static void forward_log(Value *v) {
+    v->data = log(v->prev[0]->data);
+}
+
+static void forward_div(Value *v) {
+    v->data = v->prev[0]->data / v->prev[1]->data;
+}
+
+static void forward_tanh(Value *v) {
+    v->data = tanh(v->prev[0]->data);
+}
+
+static void forward_sigmoid(Value *v) {
+    v->data = 1 / (1 + exp(-v->prev[0]->data));
+}
+
+static void forward_relu(Value *v) {
+    mg_real data = v->prev[0]->data;
+    v->data = data < 0 ? 0 : data;
+}
+
+/**
+ * y = sum(w[i] * x[i]) + b
+ * prev holds w[0..n-1], then x[0..n-1], then b
+ */
+static void forward_dot_bias(Value *v) {
+    size_t n = v->n_prev / 2;
+    Value **w = v->prev;
+    Value **x = v->prev + n;
+
+    mg_real sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += w[i]->data * x[i]->data;
+    }
+    v->data = sum + v->prev[2 * n]->data;
+}
+
+/**
+ * dy/dw[i] = x[i], dy/dx[i] = w[i], dy/db = 1
+ */
+static void backward_dot_bias(Value *v) {
+    size_t n = v->n_prev / 2;
+    Value **w = v->prev;
+    Value **x = v->prev + n;
+    mg_real g = v->grad;
+
+    for (size_t i = 0; i < n; ++i) {
+        w[i]->grad += x[i]->data * g;
+        x[i]->grad += w[i]->data * g;
+    }
+    v->prev[2 * n]->grad += g;
+}
+
+Value *value_alloc(Arena *a, mg_real data) {
     Value *v = arena_alloc(a, sizeof(Value));
     v->data = data;
     v->grad = 0.0; 
     v->prev = NULL;
     v->n_prev = 0;
     v->value_kind = VALUE_NONE;
+    v->forward = NULL;
     v->backward = NULL;
     v->op = OP_NONE;
+    v->ctx = NULL;
+    v->gen = 0;
     v->label[0] = '\0';
+    MG_PROFILE_LEAVES(1);
     return v;
 }
 
+Value **value_alloc_input(Arena *a, size_t n) {
+    Value **in = arena_alloc(a, sizeof(Value*) * n);
+    Value *leaves = arena_alloc(a, sizeof(Value) * n);
+
+    for (size_t i = 0; i < n; ++i) {
+        leaves[i] = (Value){ .value_kind = VALUE_INPUT };
+        in[i] = &leaves[i];
+    }
+    MG_PROFILE_LEAVES(n);
+    return in;
+}
+
+void value_set_input(Value **in, const mg_real *data, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        in[i]->data = data[i];
+        in[i]->grad = 0;
+    }
+}
+
 Value *value_add(Arena *a, Value *v1, Value *v2) {
     Value *out = value_alloc(a,  v1->data + v2->data);
+    out->forward = forward_add;
     out->backward = backward_add;
     out->n_prev = 2;
     out->prev = arena_alloc(a, sizeof(Value*) * 2);
@@ -120,24 +290,28 @@ Value *value_add(Arena *a, Value *v1, Value *v2) {
     out->prev[1] = v2;
     out->grad = 0.0;
     out->op = OP_ADD;
+    MG_PROFILE_NODE(OP_ADD);
     
     return out;
 }
 
 Value *value_neg(Arena *a, Value *v1) {
     Value *out = value_alloc(a,  -v1->data);
+    out->forward = forward_neg;
     out->backward = backward_neg;
     out->n_prev = 1;
     out->prev = arena_alloc(a, sizeof(Value*));
     out->prev[0] = v1;
     out->grad = 0.0;
     out->op = OP_NEG;
+    MG_PROFILE_NODE(OP_NEG);
     
     return out;
 }
 
 Value *value_sub(Arena *a, Value *v1, Value *v2) {
     Value *out = value_alloc(a, v1->data - v2->data);
+    out->forward = forward_sub;
     out->backward = backward_sub;
     out->n_prev = 2;
     out->prev = arena_alloc(a, sizeof(Value*) * 2);
@@ -145,12 +319,14 @@ Value *value_sub(Arena *a, Value *v1, Value *v2) {
     out->prev[1] = v2;
     out->grad = 0.0;
     out->op = OP_SUB;
+    MG_PROFILE_NODE(OP_SUB);
     
     return out;
 }
 
 Value *value_mul(Arena *a, Value *v1, Value *v2) {
     Value *out = value_alloc(a, v1->data * v2->data);
+    out->forward = forward_mul;
     out->backward = backward_mul;
     out->n_prev = 2;
     out->prev = arena_alloc(a, sizeof(Value*) * 2);
@@ -158,6 +334,7 @@ Value *value_mul(Arena *a, Value *v1, Value *v2) {
     out->prev[1] = v2;
     out->grad = 0.0;
     out->op = OP_MUL;
+    MG_PROFILE_NODE(OP_MUL);
     
     return out;
 }
@@ -165,6 +342,8 @@ Value *value_mul(Arena *a, Value *v1, Value *v2) {
 Value *value_pow(Arena *a, Value *v1, Value *v2) {
     Value *out = value_alloc(a, pow(v1->data, v2->data));
 
+    out->forward = forward_pow;
+
     out->backward = backward_pow;
     out->n_prev = 2;
     out->prev = arena_alloc(a, sizeof(Value*) * 2);
@@ -172,6 +351,23 @@ Value *value_pow(Arena *a, Value *v1, Value *v2) {
     out->prev[1] = v2;
     out->grad = 0.0;
     out->op = OP_POW;
+    MG_PROFILE_NODE(OP_POW);
+
+    return out;
+}
+
+Value *value_square(Arena *a, Value *v1) {
+    Value *out = value_alloc(a, v1->data * v1->data);
+
+    out->forward = forward_square;
+
+    out->backward = backward_square;
+    out->n_prev = 1;
+    out->prev = arena_alloc(a, sizeof(Value*));
+    out->prev[0] = v1;
+    out->grad = 0.0;
+    out->op = OP_SQUARE;
+    MG_PROFILE_NODE(OP_SQUARE);
 
     return out;
 }
@@ -179,12 +375,15 @@ Value *value_pow(Arena *a, Value *v1, Value *v2) {
 Value *value_exp(Arena *a, Value *v1) {
     Value *out = value_alloc(a, exp(v1->data));
 
+    out->forward = forward_exp;
+
     out->backward = backward_exp;
     out->n_prev = 1;
     out->prev = arena_alloc(a, sizeof(Value*));
     out->prev[0] = v1;
     out->grad = 0.0;
     out->op = OP_EXP;
+    MG_PROFILE_NODE(OP_EXP);
 
     return out;
 }
@@ -197,12 +396,15 @@ Value *value_log(Arena *a, Value *v1) {
 
     Value *out = value_alloc(a, log(v1->data));
 
+    out->forward = forward_log;
+
     out->backward = backward_log;
     out->n_prev = 1;
     out->prev = arena_alloc(a, sizeof(Value*));
     out->prev[0] = v1;
     out->grad = 0.0;
     out->op = OP_LOG;
+    MG_PROFILE_NODE(OP_LOG);
 
     return out;
 }
@@ -217,11 +419,14 @@ Value *value_div(Arena *a, Value *v1, Value *v2) {
     Value *out = value_alloc(a, v1->data / v2->data);
 
     out->op = OP_DIV;
+
+    MG_PROFILE_NODE(OP_DIV);
     out->n_prev = 2;
     out->prev = arena_alloc(a, sizeof(Value*) * 2);
     out->prev[0] = v1;
     out->prev[1] = v2;
     out->grad = 0.0;
+    out->forward = forward_div;
     out->backward = backward_div;
     
     return out;
@@ -233,8 +438,10 @@ Value *value_tanh(Arena *a, Value *v1) {
     out->n_prev = 1;
     out->prev = arena_alloc(a, sizeof(Value*));
     out->prev[0] = v1;
+    out->forward = forward_tanh;
     out->backward = backward_tanh;
     out->op = OP_TANH;
+    MG_PROFILE_NODE(OP_TANH);
     return out;
 }
 
@@ -244,13 +451,15 @@ Value *value_sigmoid(Arena *a, Value *v1) {
     out->n_prev = 1;
     out->prev = arena_alloc(a, sizeof(Value*));
     out->prev[0] = v1;
+    out->forward = forward_sigmoid;
     out->backward = backward_sigmoid;
     out->op = OP_SIGMOID;
+    MG_PROFILE_NODE(OP_SIGMOID);
     return out;
 }
 
 Value *value_relu(Arena *a, Value *v1) {
-    double data = v1->data;
+    mg_real data = v1->data;
 
     if (data < 0) {
         data = 0;
@@ -261,61 +470,197 @@ Value *value_relu(Arena *a, Value *v1) {
     out->n_prev = 1;
     out->prev = arena_alloc(a, sizeof(Value*));
     out->prev[0] = v1;
+    out->forward = forward_relu;
     out->backward = backward_relu;
     out->op = OP_RELU;
+    MG_PROFILE_NODE(OP_RELU);
     return out;
 }
 
-void value_backward(Arena *a, Value *v) {
-    // Build topo
-    Stack *s = stack_create();
-    Stack *visited = stack_create();
+/* Scratch arrays for the topological sort, grown with arena_da_append */
+typedef struct {
+    Value *node;
+    size_t next;    /* index of the next prev[] to visit */
+} Topo_Frame;
+
+typedef struct {
+    Topo_Frame *items;
+    size_t count;
+    size_t capacity;
+} Topo_Stack;
 
-    stack_push(s, v);
+typedef struct {
+    Value **items;
+    size_t count;
+    size_t capacity;
+} Topo_Order;
 
-    while (!stack_empty(s)) {
-        Value *node = stack_pop(s);
+/**
+ * Bumped once per pass, a node is visited iff node->gen == current pass.
+ * Atomic so that passes running on different threads never share a stamp.
+ */
+static _Atomic uint64_t topo_generation = 0;
 
-        if (stack_contains(visited, node)) {
+/**
+ * Iterative post-order DFS from v.
+ * Every node lands in order after all of its inputs, so walking order
+ * backwards visits a node only once every consumer has pushed its grad.
+ */
+static void value_topo(Arena *a, Value *v, Topo_Order *order) {
+    uint64_t gen = atomic_fetch_add(&topo_generation, 1) + 1;
+    Topo_Stack stack = {0};
+
+    v->gen = gen;
+    arena_da_append(a, &stack, ((Topo_Frame){ .node = v, .next = 0 }));
+
+    while (stack.count > 0) {
+        Topo_Frame *top = &stack.items[stack.count - 1];
+
+        if (top->next < top->node->n_prev) {
+            Value *child = top->node->prev[top->next++];
+            if (child->gen != gen) {
+                child->gen = gen;
+                arena_da_append(a, &stack, ((Topo_Frame){ .node = child, .next = 0 }));
+            }
             continue;
         }
 
-        stack_push(visited, node);
+        arena_da_append(a, order, top->node);
+        stack.count--;
+    }
+}
+
+Value **value_topo_sort(Arena *a, Value *root, size_t *n) {
+    Topo_Order order = {0};
+    value_topo(a, root, &order);
+    *n = order.count;
+    return order.items;
+}
 
-        for (size_t i = 0; i < node->n_prev; ++i) {
-            stack_push(s, node->prev[i]);
-        }
+void value_rewrite_square(Value *v) {
+    v->op = OP_SQUARE;
+    v->n_prev = 1;
+    v->forward = forward_square;
+    v->backward = backward_square;
+}
+
+void value_stop_grad(Value *v, size_t k) {
+    switch (v->op) {
+        case OP_ADD: v->backward = k ? backward_add_a : backward_add_b; break;
+        case OP_SUB: v->backward = k ? backward_add_a : backward_sub_b; break;
+        case OP_MUL: v->backward = k ? backward_mul_a : backward_mul_b; break;
+        case OP_DIV: v->backward = k ? backward_div_a : backward_div_b; break;
+        case OP_POW: v->backward = k ? backward_pow_a : backward_pow_b; break;
+        default: break;
     }
+}
 
+Value *value_dot_bias(Arena *a, Value **w, Value **x, size_t n, Value *b) {
+    Value *out = value_alloc(a, 0);
+    out->n_prev = 2 * n + 1;
+    out->prev = arena_alloc(a, sizeof(Value*) * out->n_prev);
+    memcpy(out->prev, w, sizeof(Value*) * n);
+    memcpy(out->prev + n, x, sizeof(Value*) * n);
+    out->prev[2 * n] = b;
+    out->forward = forward_dot_bias;
+    out->backward = backward_dot_bias;
+    out->op = OP_DOT_BIAS;
+    MG_PROFILE_NODE(OP_DOT_BIAS);
+
+    forward_dot_bias(out);
+    return out;
+}
+
+#if MG_PROFILE
+/* Every MG_PROFILE_SAMPLE-th node backward of a thread is timed */
+static _Thread_local unsigned profile_sample = 0;
+
+static void profile_node_backward(Profile *p, Value *node) {
+    p->backward_calls[node->op]++;
+    if (++profile_sample == MG_PROFILE_SAMPLE) {
+        profile_sample = 0;
+        uint64_t s = profile_ticks();
+        node->backward(node);
+        p->backward_ticks[node->op] += profile_ticks() - s;
+        p->backward_sampled[node->op]++;
+    } else {
+        node->backward(node);
+    }
+}
+
+static void profile_pass(Profile *p, size_t sorted, uint64_t topo_ticks, uint64_t propagate_ticks,
+                         size_t graph_bytes, size_t scratch_bytes) {
+    p->passes++;
+    p->sorted_nodes += sorted;
+    p->topo_ticks += topo_ticks;
+    p->propagate_ticks += propagate_ticks;
+    p->graph_bytes += graph_bytes;
+    if (graph_bytes > p->graph_bytes_max) p->graph_bytes_max = graph_bytes;
+    p->scratch_bytes += scratch_bytes;
+    if (scratch_bytes > p->scratch_bytes_max) p->scratch_bytes_max = scratch_bytes;
+}
+#endif
+
+void value_backward(Arena *a, Value *v) {
+    trace_begin("value_backward");
+#if MG_PROFILE
+    Profile *p = profile_local();
+    size_t graph_bytes = profile_arena_bytes(a);
+    uint64_t t0 = profile_ticks();
+#endif
+
+    /* Scratch lives at the tail of the graph arena and is dropped on return */
+    Arena_Mark mark = arena_snapshot(a);
+
+    trace_begin("topo_sort");
+    Topo_Order order = {0};
+    value_topo(a, v, &order);
+    trace_end();
+
+#if MG_PROFILE
+    uint64_t t1 = profile_ticks();
+    size_t scratch_bytes = profile_arena_bytes(a) - graph_bytes;
+#endif
     v->grad = 1.0;
 
-    for (size_t i = 0; i < visited->size; ++i) {
-        Value *node = (Value*) visited->items[i];
+    trace_begin("propagate");
+    for (size_t i = order.count; i-- > 0;) {
+        Value *node = order.items[i];
         if (node->backward) {
+#if MG_PROFILE
+            profile_node_backward(p, node);
+#else
             node->backward(node);
+#endif
         }
     }
+    trace_end();
 
-    // arena_reset(a);
-    stack_destroy(visited);
-    stack_destroy(s);
+#if MG_PROFILE
+    profile_pass(p, order.count, t1 - t0, profile_ticks() - t1, graph_bytes, scratch_bytes);
+#endif
+    arena_rewind(a, mark);
+    trace_end();
 }
 
-
 Value *mse(Arena *a, Value **pred, Value **target, size_t size) {
-    Value *out = value_alloc(a, 0);
+    if (size == 0) {
+        printf("mse: empty prediction\n");
+        exit(1);
+    }
 
-    Value *two = value_alloc(a, 2.0);
+    trace_begin("loss");
+    Value *out = value_square(a, value_sub(a, pred[0], target[0]));
 
-    for (size_t i = 0; i < size; ++i) {
+    for (size_t i = 1; i < size; ++i) {
         Value *sub = value_sub(a, pred[i], target[i]);
-        Value *pow = value_pow(a, sub, two);
-        out = value_add(a, out, pow);
+        out = value_add(a, out, value_square(a, sub));
     }
 
-    Value *n = value_alloc(a, (double)size);
+    Value *n = value_alloc(a, (mg_real)size);
 
     out = value_div(a, out, n);
+    trace_end();
     return out;
 }
 
@@ -345,7 +690,8 @@ Value *cross_entropy(Arena *a, Value **preds, Value *target, size_t size) {
         }
     }
 
-    Value *sum_exp = value_alloc(a, 0);
+    trace_begin("loss");
+    Value *sum_exp = NULL;
     Value *target_pred = NULL;
 
     for (size_t i = 0; i < size; ++i) {
@@ -356,16 +702,157 @@ Value *cross_entropy(Arena *a, Value **preds, Value *target, size_t size) {
             target_pred = exp_pred;
         }
 
-        sum_exp = value_add(a, sum_exp, exp_pred);
+        sum_exp = sum_exp ? value_add(a, sum_exp, exp_pred) : exp_pred;
     }
 
     Value *prob_target = value_div(a, target_pred, sum_exp);
     Value *log_prob = value_log(a, prob_target);
     Value *loss = value_neg(a, log_prob);
 
+    trace_end();
     return loss;
 }
 
+/**
+ * p = softmax(z) and -log(p[t]) for one row of logits.
+ * Uses log-sum-exp around the max logit instead of dividing then taking log.
+ */
+static mg_real softmax_ce_row(const mg_real *z, size_t target, size_t size, mg_real *p) {
+    mg_real max = z[0];
+    for (size_t i = 1; i < size; ++i) {
+        if (z[i] > max) max = z[i];
+    }
+
+    mg_real sum = 0;
+    for (size_t i = 0; i < size; ++i) {
+        p[i] = exp(z[i] - max);
+        sum += p[i];
+    }
+    for (size_t i = 0; i < size; ++i) {
+        p[i] /= sum;
+    }
+
+    return log(sum) - (z[target] - max);
+}
+
+static size_t softmax_ce_index(size_t target, size_t size) {
+    if (target >= size) {
+        printf("Invalid target index\n");
+        exit(1);
+    }
+    return target;
+}
+
+/* A target leaf holds the class index as a real */
+static size_t softmax_ce_target(mg_real target, size_t size) {
+    return softmax_ce_index(target < 0 ? size : (size_t)target, size);
+}
+
+/* Payload of an OP_SOFTMAX_CE node, prev holds the logits then the target */
+typedef struct {
+    size_t size;
+    mg_real *z;     /* logits gathered into a contiguous vector */
+    mg_real *p;     /* softmax probabilities of the last forward */
+} Softmax_CE_Ctx;
+
+static void forward_softmax_ce(Value *v) {
+    Softmax_CE_Ctx *ctx = v->ctx;
+    size_t target = softmax_ce_target(v->prev[ctx->size]->data, ctx->size);
+
+    for (size_t i = 0; i < ctx->size; ++i) {
+        ctx->z[i] = v->prev[i]->data;
+    }
+    v->data = softmax_ce_row(ctx->z, target, ctx->size, ctx->p);
+}
+
+/**
+ * dL/dz[i] = p[i] - (i == target)
+ */
+static void backward_softmax_ce(Value *v) {
+    Softmax_CE_Ctx *ctx = v->ctx;
+    size_t target = (size_t)v->prev[ctx->size]->data;
+
+    for (size_t i = 0; i < ctx->size; ++i) {
+        mg_real onehot = i == target ? 1 : 0;
+        v->prev[i]->grad += (ctx->p[i] - onehot) * v->grad;
+    }
+}
+
+Value *softmax_cross_entropy(Arena *a, Value **logits, Value *target, size_t size) {
+    trace_begin("loss");
+    Softmax_CE_Ctx *ctx = arena_alloc(a, sizeof(Softmax_CE_Ctx));
+    ctx->size = size;
+    ctx->z = arena_alloc(a, sizeof(mg_real) * size);
+    ctx->p = arena_alloc(a, sizeof(mg_real) * size);
+
+    Value *out = value_alloc(a, 0);
+    out->n_prev = size + 1;
+    out->prev = arena_alloc(a, sizeof(Value*) * out->n_prev);
+    memcpy(out->prev, logits, sizeof(Value*) * size);
+    out->prev[size] = target;
+    out->ctx = ctx;
+    out->forward = forward_softmax_ce;
+    out->backward = backward_softmax_ce;
+    out->op = OP_SOFTMAX_CE;
+    MG_PROFILE_NODE(OP_SOFTMAX_CE);
+
+    forward_softmax_ce(out);
+    trace_end();
+    return out;
+}
+
+/* Memory planning, mirrors the allocations of the builders */
+
+size_t value_bytes(size_t n) {
+    return n * arena_alloc_size(sizeof(Value));
+}
+
+/* A node with n_prev inputs */
+static size_t node_bytes(size_t n_prev) {
+    return value_bytes(1) + arena_alloc_size(sizeof(Value*) * n_prev);
+}
+
+size_t mse_bytes(size_t size) {
+    /* sub + square per term, an add for every term but the first, n and the final div */
+    return size * (2 * node_bytes(2) + node_bytes(1)) + value_bytes(1);
+}
+
+size_t softmax_cross_entropy_bytes(size_t size) {
+    return arena_alloc_size(sizeof(Softmax_CE_Ctx)) +
+           2 * arena_alloc_size(sizeof(mg_real) * size) +
+           node_bytes(size + 1);
+}
+
+/* Every buffer an arena_da_append-grown array of n items allocates */
+static size_t da_bytes(size_t n, size_t item_size) {
+    size_t bytes = 0;
+    for (size_t capacity = ARENA_DA_INIT_CAP; n > 0; capacity *= 2) {
+        bytes += arena_alloc_size(capacity * item_size);
+        if (capacity >= n) break;
+    }
+    return bytes;
+}
+
+size_t value_backward_bytes(size_t n_nodes, size_t depth) {
+    return da_bytes(n_nodes, sizeof(Value*)) + da_bytes(depth, sizeof(Topo_Frame));
+}
+
+mg_real softmax_cross_entropy_batch(const mg_real *logits, const size_t *targets, size_t batch_size, size_t size, mg_real *dlogits) {
+    if (batch_size == 0) return 0;
+
+    trace_begin("loss");
+    mg_real total = 0;
+    for (size_t s = 0; s < batch_size; ++s) {
+        size_t target = softmax_ce_index(targets[s], size);
+        mg_real *p = &dlogits[s * size];
+
+        total += softmax_ce_row(&logits[s * size], target, size, p);
+        p[target] -= 1;
+    }
+    trace_end();
+    return total / (mg_real)batch_size;
+}
+
 Value **soft_max(Arena *a, Value **logits, size_t size) {
     // Find max logit for numerical stability
     Value *max_logit = logits[0];
@@ -376,13 +863,13 @@ Value **soft_max(Arena *a, Value **logits, size_t size) {
     }
 
     Value **exp_vals = arena_alloc(a, sizeof(Value*) * size);
-    Value *sum_exp = value_alloc(a, 0.0);
+    Value *sum_exp = NULL;
 
     // Compute exponentials
     for (size_t i = 0; i < size; ++i) {
         Value *sub = value_sub(a, logits[i], max_logit);
         exp_vals[i] = value_exp(a, sub);
-        sum_exp = value_add(a, sum_exp, exp_vals[i]);
+        sum_exp = sum_exp ? value_add(a, sum_exp, exp_vals[i]) : exp_vals[i];
     }
 
     // Compute softmax output
@@ -403,11 +890,17 @@ const char* op_to_string(Op_Kind op) {
         case OP_DIV:   return "DIV";
         case OP_TANH:  return "TANH";
         case OP_POW:   return "POW";
+        case OP_SQUARE: return "SQUARE";
         case OP_EXP:   return "EXP";
         case OP_LOG:   return "LOG";
         case OP_NEG:   return "NEG";
         case OP_SIGMOID: return "SIGMOID";
         case OP_RELU:  return "RELU";
+        case OP_DOT_BIAS: return "DOT_BIAS";
+        case OP_SOFTMAX_CE: return "SOFTMAX_CE";
+        case OP_DENSE: return "DENSE";
+        case OP_CHECKPOINT: return "CHECKPOINT";
+        case OP_OUTPUT: return "OUTPUT";
         default:       return "UNKNOWN";
     }
 }
@@ -421,6 +914,10 @@ const char* op_to_color(Op_Kind op) {
         case OP_DIV:  return "pink";
         case OP_TANH: return "yellow";
         case OP_POW:  return "violet";
+        case OP_SQUARE: return "violet";
+        case OP_DOT_BIAS: return "lightblue";
+        case OP_DENSE: return "khaki";
+        case OP_CHECKPOINT: return "wheat";
         default:      return "white";
     }
 }